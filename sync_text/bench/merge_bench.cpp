@@ -0,0 +1,182 @@
+// Merge pass benchmark (crdt.h): do_merge_apply against the nested-loop pass
+// it replaced, over growing bursts of buffered column edits.
+//
+// Two authors edit random columns of a 2000 x 80-char document; a quarter of
+// each author's edits continue their previous edit (typing), and edits of
+// the two authors overlap often enough for LWW to drop some. Each burst size
+// runs several times; the median is reported, followed by the smallest burst
+// at which the sorted pass is faster.
+//
+// Usage: bench/merge_bench [max_burst] [runs]
+
+#include "../include/crdt.h"
+#include "../include/replica.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <map>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+static uint64_t now_ns() {
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static constexpr std::size_t LINES = 2000;
+static constexpr int LINE_LEN = 80;
+
+// The merge as it was before the sorted pass: chained updates folded and
+// conflicts found by comparing every pair, survivors applied per line
+static void old_merge_apply(std::vector<std::string> &lines, const std::vector<UpdateExt> &local_unmerged,
+                            const std::vector<UpdateExt> &recv_unmerged) {
+  std::vector<UpdateExt> all;
+  all.reserve(local_unmerged.size() + recv_unmerged.size());
+  all.insert(all.end(), local_unmerged.begin(), local_unmerged.end());
+  all.insert(all.end(), recv_unmerged.begin(), recv_unmerged.end());
+
+  for (size_t i = 0; i < all.size(); ++i) {
+    for (size_t j = i + 1; j < all.size(); ++j) {
+      if (all[i].line == all[j].line && all[i].rid == all[j].rid && all[i].new_text == all[j].old_text &&
+          all[i].cs == all[j].cs) {
+        all[i].new_text = all[j].new_text;
+        all[i].ts = all[j].ts;
+        all[j].old_text = "###MERGED###";
+      }
+    }
+  }
+  std::vector<char> alive(all.size(), 1);
+  for (size_t i = 0; i < all.size(); ++i) {
+    if (!alive[i]) continue;
+    if (all[i].old_text == "###MERGED###") { alive[i] = 0; continue; }
+    for (size_t j = i + 1; j < all.size(); ++j) {
+      if (!alive[j]) continue;
+      if (all[j].old_text == "###MERGED###") { alive[j] = 0; continue; }
+      if (overlaps(all[i], all[j])) {
+        if (newer_wins(all[i], all[j])) {
+          alive[j] = 0;
+        } else {
+          alive[i] = 0;
+          break;
+        }
+      }
+    }
+  }
+
+  std::map<uint32_t, std::vector<UpdateExt>> updates_per_line;
+  for (size_t i = 0; i < all.size(); ++i) {
+    if (alive[i]) updates_per_line[all[i].line].push_back(all[i]);
+  }
+  for (auto &kv : updates_per_line) {
+    auto &vec = kv.second;
+    std::sort(vec.begin(), vec.end(), [](const UpdateExt &a, const UpdateExt &b) {
+      if (a.cs != b.cs) return a.cs < b.cs;
+      return a.ts > b.ts;
+    });
+    std::string cur = lines[kv.first];
+    int offset = 0;
+    for (const auto &u : vec) {
+      int cs = std::max(0, u.cs + offset);
+      int ce = std::min(u.ce + offset, static_cast<int>(cur.size()) - 1);
+      std::string next = cur.substr(0, cs);
+      next.append(u.new_text);
+      if (ce >= 0 && static_cast<size_t>(ce + 1) < cur.size()) next += cur.substr(ce + 1);
+      offset += static_cast<int>(u.new_text.size()) - (ce - cs + 1);
+      cur = std::move(next);
+    }
+    lines[kv.first] = std::move(cur);
+  }
+}
+
+struct Burst {
+  std::deque<std::string> text; // backs the views in the ops
+  std::vector<UpdateExt> local, recv;
+};
+
+static void make_burst(std::size_t n, const std::vector<std::string> &base, Burst &b) {
+  std::mt19937 rng(static_cast<uint32_t>(n));
+  uint16_t rids[2] = {replica_intern("A"), replica_intern("B")};
+  b.text.clear();
+  b.local.clear();
+  b.recv.clear();
+  for (std::size_t i = 0; i < n; ++i) {
+    auto &mine = i % 2 ? b.recv : b.local;
+    UpdateExt u;
+    u.ts = i + 1;
+    u.rid = rids[i % 2];
+    u.op = OpType::Replace;
+    if (!mine.empty() && rng() % 4 == 0) { // keep typing over the previous edit
+      const UpdateExt &prev = mine.back();
+      u.line = prev.line;
+      u.cs = prev.cs;
+      u.old_text = prev.new_text;
+      b.text.push_back(std::string(prev.new_text) + static_cast<char>('a' + rng() % 26));
+    } else {
+      u.line = static_cast<uint32_t>(rng() % LINES);
+      u.cs = static_cast<int>(rng() % (LINE_LEN - 4));
+      b.text.push_back(base[u.line].substr(static_cast<size_t>(u.cs), 1 + rng() % 4));
+      u.old_text = b.text.back();
+      b.text.push_back(std::string(1, static_cast<char>('A' + rng() % 26)));
+    }
+    u.new_text = b.text.back();
+    u.ce = u.cs + static_cast<int>(u.old_text.size()) - 1;
+    mine.push_back(u);
+  }
+}
+
+template <typename F>
+static uint64_t median_ns(int runs, F run) {
+  std::vector<uint64_t> ts;
+  for (int i = 0; i < runs; ++i) ts.push_back(run());
+  std::sort(ts.begin(), ts.end());
+  return ts[ts.size() / 2];
+}
+
+int main(int argc, char **argv) {
+  std::size_t max_burst = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 20000;
+  int runs = argc > 2 ? std::atoi(argv[2]) : 5;
+  if (max_burst < 2 || runs <= 0) {
+    std::fprintf(stderr, "Usage: %s [max_burst >= 2] [runs]\n", argv[0]);
+    return 1;
+  }
+
+  std::vector<std::string> base(LINES);
+  std::mt19937 rng(1);
+  for (auto &l : base) {
+    for (int c = 0; c < LINE_LEN; ++c) l.push_back(static_cast<char>('a' + rng() % 26));
+  }
+
+  std::printf("%zu x %d-char lines, median of %d runs\n", LINES, LINE_LEN, runs);
+  std::printf("%8s %14s %14s %8s\n", "burst", "nested (us)", "sorted (us)", "speedup");
+  std::size_t crossover = 0;
+  Burst b;
+  for (std::size_t n = 2; n <= max_burst; n = n < 10 ? n * 2 + 1 : n * 2) {
+    make_burst(n, base, b);
+    uint64_t old_ns = median_ns(runs, [&] {
+      std::vector<std::string> lines = base;
+      uint64_t t0 = now_ns();
+      old_merge_apply(lines, b.local, b.recv);
+      return now_ns() - t0;
+    });
+    uint64_t new_ns = median_ns(runs, [&] {
+      Document doc(base);
+      std::vector<UpdateExt> local = b.local, recv = b.recv;
+      uint64_t t0 = now_ns();
+      do_merge_apply(doc, local, recv, "A");
+      return now_ns() - t0;
+    });
+    if (!crossover && new_ns < old_ns) crossover = n;
+    if (crossover && new_ns >= old_ns) crossover = 0; // only count a lasting lead
+    std::printf("%8zu %14.1f %14.1f %7.1fx\n", n, static_cast<double>(old_ns) / 1e3,
+                static_cast<double>(new_ns) / 1e3, static_cast<double>(old_ns) / static_cast<double>(new_ns));
+  }
+  if (crossover) std::printf("sorted pass is faster from bursts of %zu updates\n", crossover);
+  else std::printf("sorted pass not faster at bursts up to %zu updates\n", max_burst);
+  return 0;
+}
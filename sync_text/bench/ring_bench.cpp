@@ -0,0 +1,185 @@
+// RingBuffer benchmark (ring_buffer.h) against the ring it replaced.
+//
+// One producer and one consumer thread pass uint64 timestamps through a
+// 128-slot ring (the size of the listener -> main loop ring):
+//   stream:  the producer pushes as fast as the ring takes them; ops/s, and
+//            p50 / p99 of the time an item spends in the ring (queueing)
+//   handoff: one item in flight at a time; p50 / p99 of push -> pop, the
+//            latency an update sees when traffic is light
+// Each variant runs several times; the median run is reported.
+//
+// Usage: bench/ring_bench [stream_ops] [handoff_ops] [runs]
+
+#include "../include/ring_buffer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <sched.h>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+static uint64_t now_ns() {
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// The ring as it was before ring_buffer.h: shared indices on one cache line,
+// modulo per op, one slot unused
+template <typename T, std::size_t CAP>
+struct OldRing {
+  std::atomic<size_t> head{0};
+  std::atomic<size_t> tail{0};
+  T data[CAP];
+  bool push(const T &v) {
+    size_t h = head.load(std::memory_order_relaxed);
+    size_t n = (h + 1) % CAP;
+    if (n == tail.load(std::memory_order_acquire)) return false; // full
+    data[h] = v;
+    head.store(n, std::memory_order_release);
+    return true;
+  }
+  bool pop(T &out) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) return false; // empty
+    out = data[t];
+    tail.store((t + 1) % CAP, std::memory_order_release);
+    return true;
+  }
+  size_t size() const {
+    return (head.load(std::memory_order_acquire) + CAP - tail.load(std::memory_order_acquire)) % CAP;
+  }
+};
+
+constexpr std::size_t CAP = 128;
+constexpr std::size_t SAMPLE_EVERY = 997; // prime: samples land evenly over a fill/drain cycle
+
+struct Result {
+  double ops_per_s = 0;
+  double fill = 0; // mean items in the ring when a sample is popped
+  uint64_t p50 = 0;
+  uint64_t p99 = 0;
+};
+
+static void percentiles(std::vector<uint64_t> &lat, Result &r) {
+  std::sort(lat.begin(), lat.end());
+  r.p50 = lat[lat.size() / 2];
+  r.p99 = lat[lat.size() * 99 / 100];
+}
+
+// Consumers: pop one at a time, or up to 32 per call
+template <typename Ring>
+static bool take(Ring &ring, uint64_t *buf, std::size_t &n, bool bulk) {
+  if constexpr (!std::is_same_v<Ring, OldRing<uint64_t, CAP>>) {
+    if (bulk) {
+      n = ring.pop_n(buf, 32);
+      return n > 0;
+    }
+  }
+  n = ring.pop(buf[0]) ? 1 : 0;
+  return n > 0;
+}
+
+template <typename Ring>
+static Result stream(std::size_t ops, bool bulk) {
+  auto ring = std::make_unique<Ring>();
+  std::vector<uint64_t> lat;
+  lat.reserve(ops / SAMPLE_EVERY + 1);
+  double fill = 0;
+  uint64_t t0 = now_ns();
+  std::thread consumer([&] {
+    uint64_t buf[32];
+    std::size_t got = 0, n;
+    while (got < ops) {
+      if (!take(*ring, buf, n, bulk)) {
+        sched_yield();
+        continue;
+      }
+      uint64_t t = now_ns();
+      for (std::size_t i = 0; i < n; ++i) {
+        if ((got + i) % SAMPLE_EVERY != 0) continue;
+        lat.push_back(t - buf[i]);
+        fill += static_cast<double>(ring->size() + n - i);
+      }
+      got += n;
+    }
+  });
+  for (std::size_t i = 0; i < ops; ++i) {
+    uint64_t stamp = i % SAMPLE_EVERY == 0 ? now_ns() : 0;
+    while (!ring->push(stamp)) sched_yield();
+  }
+  consumer.join();
+  Result r;
+  r.ops_per_s = static_cast<double>(ops) / (static_cast<double>(now_ns() - t0) / 1e9);
+  r.fill = fill / static_cast<double>(lat.size());
+  percentiles(lat, r);
+  return r;
+}
+
+template <typename Ring>
+static Result handoff(std::size_t ops) {
+  auto ring = std::make_unique<Ring>();
+  std::vector<uint64_t> lat(ops);
+  std::atomic<std::size_t> done{0};
+  std::thread consumer([&] {
+    uint64_t v;
+    for (std::size_t i = 0; i < ops; ++i) {
+      while (!ring->pop(v)) sched_yield();
+      lat[i] = now_ns() - v;
+      done.store(i + 1, std::memory_order_release);
+    }
+  });
+  for (std::size_t i = 0; i < ops; ++i) {
+    ring->push(now_ns());
+    while (done.load(std::memory_order_acquire) <= i) sched_yield();
+  }
+  consumer.join();
+  Result r;
+  percentiles(lat, r);
+  return r;
+}
+
+// Median run by the reported figure
+template <typename F>
+static Result median(int runs, F run, bool by_rate) {
+  std::vector<Result> rs;
+  for (int i = 0; i < runs; ++i) rs.push_back(run());
+  std::sort(rs.begin(), rs.end(), [&](const Result &a, const Result &b) {
+    return by_rate ? a.ops_per_s < b.ops_per_s : a.p99 < b.p99;
+  });
+  return rs[rs.size() / 2];
+}
+
+int main(int argc, char **argv) {
+  std::size_t stream_ops = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 5000000;
+  std::size_t handoff_ops = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 20000;
+  int runs = argc > 3 ? std::atoi(argv[3]) : 5;
+  if (stream_ops < SAMPLE_EVERY || handoff_ops == 0 || runs <= 0) {
+    std::fprintf(stderr, "Usage: %s [stream_ops >= %zu] [handoff_ops] [runs]\n", argv[0], SAMPLE_EVERY);
+    return 1;
+  }
+  using Old = OldRing<uint64_t, CAP>;
+  using New = RingBuffer<uint64_t, CAP>;
+  std::printf("%u CPU(s), %zu-slot rings, median of %d runs\n", std::thread::hardware_concurrency(), CAP, runs);
+
+  auto print_stream = [](const char *label, const Result &r) {
+    std::printf("stream   %-10s %7.1f Mops/s  fill %5.1f  in ring p50 %8.0f ns  p99 %8.0f ns\n", label,
+                r.ops_per_s / 1e6, r.fill, static_cast<double>(r.p50), static_cast<double>(r.p99));
+  };
+  print_stream("old", median(runs, [&] { return stream<Old>(stream_ops, false); }, true));
+  print_stream("new pop", median(runs, [&] { return stream<New>(stream_ops, false); }, true));
+  print_stream("new pop_n", median(runs, [&] { return stream<New>(stream_ops, true); }, true));
+
+  auto print_handoff = [](const char *label, const Result &r) {
+    std::printf("handoff  %-10s                          push->pop p50 %8.0f ns  p99 %8.0f ns\n", label,
+                static_cast<double>(r.p50), static_cast<double>(r.p99));
+  };
+  print_handoff("old", median(runs, [&] { return handoff<Old>(handoff_ops); }, false));
+  print_handoff("new", median(runs, [&] { return handoff<New>(handoff_ops); }, false));
+  return 0;
+}
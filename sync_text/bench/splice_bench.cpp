@@ -0,0 +1,111 @@
+// Line splice benchmark (crdt.h): splice_line against the per-update
+// rebuild it replaced, on long lines carrying hundreds of edits.
+//
+// Each case is one line with evenly spaced 3-character replaces, sorted by
+// column as the merge hands them over. Both variants produce the same line
+// for replaces (they differ on inserts, see splice_line); the result is
+// checked before timing. The best of several runs is reported.
+//
+// Usage: bench/splice_bench [runs]
+
+#include "../include/crdt.h"
+#include "../include/replica.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+static uint64_t now_ns() {
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// The splice as it was before splice_line: the line is rebuilt with two
+// substr copies and a concatenation per update, shifting later columns by
+// the length change so far
+static std::string old_splice(std::string cur, const UpdateExt *first, const UpdateExt *last) {
+  int offset = 0;
+  for (const UpdateExt *up = first; up != last; ++up) {
+    const UpdateExt &u = *up;
+    int cs = std::max(0, u.cs + offset);
+    int ce = std::min(u.ce + offset, static_cast<int>(cur.size()) - 1);
+    std::string next = cur.substr(0, cs);
+    next += u.new_text;
+    if (ce >= 0 && static_cast<size_t>(ce + 1) < cur.size()) next += cur.substr(ce + 1);
+    offset += static_cast<int>(u.new_text.size()) - (ce - cs + 1);
+    cur = std::move(next);
+  }
+  return cur;
+}
+
+template <typename F>
+static uint64_t best_ns(int runs, F run) {
+  uint64_t best = UINT64_MAX;
+  for (int i = 0; i < runs; ++i) best = std::min(best, run());
+  return best;
+}
+
+int main(int argc, char **argv) {
+  int runs = argc > 1 ? std::atoi(argv[1]) : 7;
+  if (runs <= 0) {
+    std::fprintf(stderr, "Usage: %s [runs]\n", argv[0]);
+    return 1;
+  }
+  struct Case {
+    std::size_t chars, edits;
+  };
+  const Case cases[] = {{2000, 100}, {2000, 500}, {10000, 100}, {10000, 500}, {100000, 1000}};
+  const uint16_t rid = replica_intern("A");
+  const std::string new_text = "XYZW"; // one longer than it replaces
+
+  std::printf("best of %d runs, 3-char replaces evenly spaced\n", runs);
+  std::printf("%8s %6s %14s %14s %8s\n", "chars", "edits", "rebuild (us)", "splice (us)", "speedup");
+  for (const Case &c : cases) {
+    std::string line;
+    for (std::size_t i = 0; i < c.chars; ++i) line.push_back(static_cast<char>('a' + i % 26));
+    std::vector<UpdateExt> ups;
+    std::size_t step = c.chars / c.edits;
+    for (std::size_t k = 0; k < c.edits; ++k) {
+      UpdateExt u;
+      u.ts = k + 1;
+      u.rid = rid;
+      u.line = 0;
+      u.cs = static_cast<int>(k * step);
+      u.ce = u.cs + 2;
+      u.op = OpType::Replace;
+      u.old_text = std::string_view(line).substr(static_cast<std::size_t>(u.cs), 3);
+      u.new_text = new_text;
+      ups.push_back(u);
+    }
+    const UpdateExt *first = ups.data();
+    const UpdateExt *last = ups.data() + ups.size();
+
+    std::string out;
+    splice_line(line, first, last, out);
+    if (out != old_splice(line, first, last)) {
+      std::fprintf(stderr, "results differ at %zu chars, %zu edits\n", c.chars, c.edits);
+      return 1;
+    }
+    std::size_t sink = 0;
+    uint64_t old_ns = best_ns(runs, [&] {
+      uint64_t t0 = now_ns();
+      sink += old_splice(line, first, last).size();
+      return now_ns() - t0;
+    });
+    uint64_t new_ns = best_ns(runs, [&] {
+      uint64_t t0 = now_ns();
+      std::string o;
+      splice_line(line, first, last, o);
+      sink += o.size();
+      return now_ns() - t0;
+    });
+    std::printf("%8zu %6zu %14.1f %14.1f %7.1fx\n", c.chars, c.edits, static_cast<double>(old_ns) / 1e3,
+                static_cast<double>(new_ns) / 1e3, static_cast<double>(old_ns) / static_cast<double>(new_ns));
+    if (sink == 0) return 1; // keeps the work observable
+  }
+  return 0;
+}
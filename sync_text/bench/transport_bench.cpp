@@ -0,0 +1,156 @@
+// Transport benchmark: POSIX message queue vs shared-memory ring (shm_ring.h).
+//
+// Two processes exchange WIRE_MSG_MAX-bounded frames the way two editors do:
+//   latency:    ping-pong of one small frame, round trip p50 / p99
+//   throughput: one producer streams frames to one consumer
+// Queues use the editor's attributes (10 messages of WIRE_MSG_MAX bytes);
+// consumers block like the editor's listener (mq_receive / futex wait).
+//
+// Usage: bench/transport_bench [rounds] [frames] [frame_bytes]
+
+#include "../include/shm_ring.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <mqueue.h>
+#include <sched.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+static uint64_t now_ns() {
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// One direction of a transport
+struct Channel {
+  virtual ~Channel() = default;
+  virtual void send(const char *data, std::size_t n) = 0;
+  virtual long recv(char *buf, std::size_t cap) = 0;
+};
+
+struct MqChannel : Channel {
+  std::string name;
+  mqd_t mq = (mqd_t)-1;
+  explicit MqChannel(const char *n) : name(n) {
+    mq_unlink(n);
+    struct mq_attr attr{};
+    attr.mq_maxmsg = 10;
+    attr.mq_msgsize = WIRE_MSG_MAX;
+    mq = mq_open(n, O_CREAT | O_RDWR, 0600, &attr);
+    if (mq == (mqd_t)-1) {
+      std::perror("mq_open");
+      std::exit(1);
+    }
+  }
+  ~MqChannel() override {
+    mq_close(mq);
+    mq_unlink(name.c_str());
+  }
+  void send(const char *data, std::size_t n) override { mq_send(mq, data, n, 0); }
+  long recv(char *buf, std::size_t cap) override { return static_cast<long>(mq_receive(mq, buf, cap, nullptr)); }
+};
+
+struct RingChannel : Channel {
+  std::string name;
+  ShmRing *ring = nullptr;
+  explicit RingChannel(const char *n) : name(n) {
+    if (shm_ring_create(n, ring) != 0) {
+      std::perror("shm_ring_create");
+      std::exit(1);
+    }
+  }
+  ~RingChannel() override {
+    shm_ring_detach(ring);
+    shm_unlink(name.c_str());
+  }
+  void send(const char *data, std::size_t n) override {
+    while (shm_ring_push(ring, data, n) != 0) sched_yield(); // full
+  }
+  long recv(char *buf, std::size_t cap) override {
+    for (;;) {
+      uint32_t seen = ring->futex_word.load(std::memory_order_seq_cst);
+      long n = shm_ring_pop(ring, buf, cap);
+      if (n >= 0) return n;
+      shm_ring_wait(ring, seen, -1);
+    }
+  }
+};
+
+// Runs child() in a forked process; the channels are shared with it
+template <typename F>
+static void run_child(F child) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    child();
+    _exit(0);
+  }
+  if (pid < 0) {
+    std::perror("fork");
+    std::exit(1);
+  }
+}
+
+static void bench(const char *label, Channel &ping, Channel &pong, int rounds, int frames, std::size_t bytes) {
+  std::vector<char> msg(bytes, 'x');
+  char buf[WIRE_MSG_MAX];
+
+  // Latency: the child echoes every frame back
+  run_child([&] {
+    for (int i = 0; i < rounds; ++i) {
+      long n = ping.recv(buf, sizeof(buf));
+      pong.send(buf, static_cast<std::size_t>(n));
+    }
+  });
+  std::vector<uint64_t> rtt;
+  rtt.reserve(static_cast<std::size_t>(rounds));
+  for (int i = 0; i < rounds; ++i) {
+    uint64_t t0 = now_ns();
+    ping.send(msg.data(), msg.size());
+    pong.recv(buf, sizeof(buf));
+    rtt.push_back(now_ns() - t0);
+  }
+  wait(nullptr);
+  std::sort(rtt.begin(), rtt.end());
+
+  // Throughput: the child drains frames, then acknowledges the last one
+  run_child([&] {
+    for (int i = 0; i < frames; ++i) ping.recv(buf, sizeof(buf));
+    pong.send("k", 1);
+  });
+  uint64_t t0 = now_ns();
+  for (int i = 0; i < frames; ++i) ping.send(msg.data(), msg.size());
+  pong.recv(buf, sizeof(buf));
+  double secs = static_cast<double>(now_ns() - t0) / 1e9;
+  wait(nullptr);
+
+  std::printf("%-6s round trip p50 %6.2f us  p99 %6.2f us   throughput %9.0f frames/s (%zu B)\n", label,
+              static_cast<double>(rtt[rtt.size() / 2]) / 1e3, static_cast<double>(rtt[rtt.size() * 99 / 100]) / 1e3,
+              frames / secs, bytes);
+}
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? std::atoi(argv[1]) : 20000;
+  int frames = argc > 2 ? std::atoi(argv[2]) : 200000;
+  std::size_t bytes = argc > 3 ? static_cast<std::size_t>(std::atoi(argv[3])) : 64;
+  if (rounds <= 0 || frames <= 0 || bytes == 0 || bytes > WIRE_MSG_MAX) {
+    std::fprintf(stderr, "Usage: %s [rounds] [frames] [frame_bytes <= %zu]\n", argv[0], WIRE_MSG_MAX);
+    return 1;
+  }
+  {
+    MqChannel ping("/synctext_bench_ping"), pong("/synctext_bench_pong");
+    bench("mqueue", ping, pong, rounds, frames, bytes);
+  }
+  {
+    RingChannel ping(SHM_RING_PREFIX "bench_ping"), pong(SHM_RING_PREFIX "bench_pong");
+    bench("shm", ping, pong, rounds, frames, bytes);
+  }
+  return 0;
+}
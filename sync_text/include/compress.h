@@ -0,0 +1,17 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+// Small byte-oriented LZ77 codec for state transfers (see join.h).
+// Greedy matching through a hash table of 4-byte prefixes, no entropy stage:
+// documents are mostly repeated tokens and indentation, which this already
+// shrinks severalfold at memcpy-like speed. Stream format, repeated:
+//   varint literal_len, literal bytes, varint match_len
+//   (match_len == 0 ends the stream, otherwise varint offset follows)
+
+constexpr std::size_t LZ_MIN_MATCH = 4;
+
+// API
+void lz_compress(const char *src, std::size_t n, std::string &out);
+// Fails on malformed input or if the output would exceed max_out bytes
+bool lz_decompress(const char *src, std::size_t n, std::string &out, std::size_t max_out);
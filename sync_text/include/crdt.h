@@ -1,25 +1,65 @@
 #pragma once
 #include "message.h"
+#include "document.h"
+#include <cstddef>
+#include <map>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <cstdint>
 
-// Extended update structure for CRDT merge
+// Extended update structure for CRDT merge. The author is an interned
+// replica id (replica.h), so comparisons are integer compares. The strings
+// are views: pending
+// updates keep their text in a MergeArena, decoded ones (op log replay, state
+// transfer) in the buffer they were decoded from. Records are plain values,
+// so the merge moves them around without touching the heap.
 struct UpdateExt {
-  uint64_t ts;        // timestamp
-  std::string uid;    // user_id
+  uint64_t ts;             // HLC timestamp
+  uint16_t rid;            // author, interned user_id
   uint32_t line;
-  int cs, ce;         // col_start, col_end
+  int cs, ce;              // col_start, col_end
   OpType op;
-  std::string old_text;
-  std::string new_text;
+  std::string_view old_text;
+  std::string_view new_text;
 };
 
+// Backing store for the text of a batch of pending updates. Strings are
+// appended to large chunks that never move, and the whole batch is released
+// at once after it is merged (the first chunk is kept for the next batch).
+constexpr std::size_t ARENA_CHUNK = std::size_t(64) << 10;
+
+struct MergeArena {
+  struct Chunk {
+    std::unique_ptr<char[]> data;
+    std::size_t size;
+  };
+  std::vector<Chunk> chunks;
+  std::size_t used = 0; // bytes used in chunks.back()
+
+  std::string_view store(std::string_view s);
+  void clear();
+};
+
+// Copy u's text into arena
+UpdateExt update_store(MergeArena &arena, const UpdateExt &u);
+
+// Highest timestamp per user whose updates are folded into a baseline
+using StateVector = std::map<std::string, uint64_t, std::less<>>; // looked up by string_view
+
+// Raise sv to cover ops
+void state_vector_add(StateVector &sv, const std::vector<UpdateExt> &ops);
+// u is folded into a baseline with state vector sv
+bool state_vector_covers(const StateVector &sv, const UpdateExt &u);
+
 // CRDT merge functions
 bool overlaps(const UpdateExt &a, const UpdateExt &b);
 bool newer_wins(const UpdateExt &a, const UpdateExt &b);
 std::string apply_update_to_line(const std::string &cur, const UpdateExt &u);
-bool do_merge_apply(std::vector<std::string> &lines, 
+// Write cur with a column-ordered run of updates into out in one pass
+void splice_line(const std::string &cur, const UpdateExt *first, const UpdateExt *last, std::string &out);
+bool do_merge_apply(Document &lines,
                     std::vector<UpdateExt> &local_unmerged,
                     std::vector<UpdateExt> &recv_unmerged,
                     const std::string &self_uid);
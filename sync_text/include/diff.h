@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Line diff engine for local change detection.
+// Lines are compared by 64-bit fingerprint; after trimming the common prefix
+// and suffix the remaining region is diffed with Myers' O(ND) algorithm in its
+// linear-space (middle snake) form, so typical saves of large files cost
+// little more than one pass over the hashes.
+
+// A replaced region: old[old_pos, old_pos+old_len) became new[new_pos, new_pos+new_len)
+struct DiffHunk {
+  std::size_t old_pos;
+  std::size_t old_len;
+  std::size_t new_pos;
+  std::size_t new_len;
+};
+
+// Hunks in ascending position order
+std::vector<DiffHunk> diff_lines(const std::vector<uint64_t> &old_hashes,
+                                 const std::vector<uint64_t> &new_hashes);
+
+// Minimal differing span of one edited line (common prefix/suffix removed).
+// Returns false if the lines are equal.
+bool diff_line_span(std::string_view old_line, std::string_view new_line,
+                    int &cs, std::string &old_seg, std::string &new_seg);
@@ -0,0 +1,77 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "document.h"
+
+// Document file I/O.
+// The document is mapped read-only and split on '\n' with memchr (glibc's is
+// vectorised), producing views into the mapping instead of one heap string per
+// line. Callers copy out only the lines they keep. Line semantics match the
+// old getline loop: no trailing '\n' on the last line required, '\r' kept,
+// trailing empty lines dropped.
+//
+// Views are valid until doc_unmap(). A mapped file that shrinks would fault
+// the reader (SIGBUS), so a file is only mapped under a read lease
+// (F_SETLEASE): another process that opens it for writing or truncates it
+// waits until doc_unmap() releases the lease (or lease-break-time passes).
+// Files below DOC_MAP_MIN, and files that cannot be leased (open for writing
+// elsewhere, owned by another user, unsupported file system), are copied
+// into memory with read() instead. SIGIO is ignored from the first doc_map()
+// on, since a lease break raises it.
+//
+// Merged documents are written back with doc_write(): normally a temp file in
+// the same directory, one write() and an atomic rename(), so readers and a
+// crash only ever see the old or the new file. If the line count is unchanged
+// and every changed line keeps its byte length, the changed lines are patched
+// in place with pwrite() instead, using the line offsets (DocLayout) recorded
+// when the file was last read or written.
+
+// Identity of one version of the file on disk
+struct FileStamp {
+  uint64_t mtime_ns = 0;
+  uint64_t size = 0;
+  uint64_t ino = 0;
+  bool operator==(const FileStamp &o) const { return mtime_ns == o.mtime_ns && size == o.size && ino == o.ino; }
+  bool operator!=(const FileStamp &o) const { return !(*this == o); }
+};
+
+struct MappedDoc {
+  const char *data = nullptr; // the mapping, or copy
+  std::size_t size = 0;
+  FileStamp stamp;
+  std::vector<std::string_view> lines;
+  int lease_fd = -1;          // open while mapped: holds the read lease
+  std::vector<char> copy;     // contents when read instead of mapped
+};
+
+// Byte offset of every line in the file as last read or written
+struct DocLayout {
+  std::vector<uint64_t> line_off;
+  FileStamp stamp;
+};
+
+// Files smaller than this are read instead of mapped
+constexpr std::size_t DOC_MAP_MIN = std::size_t(64) << 10;
+// A document that could not be read is tried again after this long
+constexpr int DOC_RETRY_MS = 200;
+// Patch in place only when at most this many lines changed
+constexpr std::size_t DOC_PATCH_MAX_LINES = 64;
+
+// API
+// 0 on success (missing file => empty), <0 if the file cannot be read (d is
+// then empty and must not be taken for the document)
+int doc_map(const char *path, MappedDoc &d);
+void doc_unmap(MappedDoc &d);
+void doc_layout(const MappedDoc &d, DocLayout &layout);
+bool doc_stamp(const char *path, FileStamp &s);
+// Replace path with data via temp file + rename; sync flushes the data to disk
+// before the rename. stamp (if set) receives the new file's stamp.
+int doc_replace_file(const char *path, const char *data, std::size_t n, bool sync, FileStamp *stamp);
+// disk/disk_hashes describe the current file contents, doc/hashes the new
+// ones. Returns 0 after a full rewrite, 1 after an in-place patch, <0 on error
+// (file left untouched). layout is updated to the new file on success.
+int doc_write(const char *path, const Document &doc, const std::vector<uint64_t> &hashes,
+              const Document &disk, const std::vector<uint64_t> &disk_hashes, DocLayout &layout);
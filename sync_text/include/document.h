@@ -0,0 +1,73 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Persistent line-indexed document.
+// Lines live in an immutable AVL tree ordered by position; edits copy only the
+// O(log n) nodes on the path to the edited line and share everything else.
+// Copying a Document is O(1), so baseline / preview / merged versions of the
+// same text share memory and "snapshot before merge" costs nothing. Line text
+// is held through its own shared pointer so path copies never copy strings.
+class Document {
+ public:
+  Document() = default;
+  explicit Document(std::vector<std::string> lines);
+
+  std::size_t size() const;
+  bool empty() const { return size() == 0; }
+
+  // O(log n) access and edits
+  const std::string &operator[](std::size_t i) const;
+  const std::string &back() const { return (*this)[size() - 1]; }
+  void set(std::size_t i, std::string line);
+  void insert(std::size_t i, std::string line);
+  void erase(std::size_t i);
+  void push_back(std::string line) { insert(size(), std::move(line)); }
+  void pop_back() { erase(size() - 1); }
+
+  // In-order traversal, f(index, line)
+  template <typename F>
+  void for_each(F f) const {
+    std::vector<const Node *> stack;
+    std::size_t idx = 0;
+    const Node *n = root.get();
+    while (n || !stack.empty()) {
+      while (n) {
+        stack.push_back(n);
+        n = n->left.get();
+      }
+      n = stack.back();
+      stack.pop_back();
+      f(idx++, *n->line);
+      n = n->right.get();
+    }
+  }
+
+  std::vector<std::string> to_vector() const;
+
+ private:
+  struct Node;
+  using NodePtr = std::shared_ptr<const Node>;
+  using LinePtr = std::shared_ptr<const std::string>;
+  struct Node {
+    NodePtr left;
+    NodePtr right;
+    LinePtr line;
+    std::size_t count; // lines in this subtree
+    int height;
+  };
+
+  static std::size_t count_of(const NodePtr &n) { return n ? n->count : 0; }
+  static int height_of(const NodePtr &n) { return n ? n->height : 0; }
+  static NodePtr make(NodePtr l, LinePtr line, NodePtr r);
+  static NodePtr balance(NodePtr l, LinePtr line, NodePtr r);
+  static NodePtr build(std::vector<std::string> &lines, std::size_t lo, std::size_t hi);
+  static NodePtr insert_at(const NodePtr &n, std::size_t i, LinePtr line);
+  static NodePtr erase_at(const NodePtr &n, std::size_t i);
+  static NodePtr set_at(const NodePtr &n, std::size_t i, LinePtr line);
+  static NodePtr erase_min(const NodePtr &n, LinePtr &out);
+
+  NodePtr root;
+};
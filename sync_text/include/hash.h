@@ -0,0 +1,12 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// 64-bit content fingerprints for lines and whole documents (XXH64).
+// The main loop consumes 32 bytes per step in four independent lanes, which
+// keeps the multipliers busy in parallel (and lets the compiler vectorise)
+// instead of hashing byte by byte like std::hash.
+uint64_t hash_bytes(const void *data, std::size_t n, uint64_t seed = 0);
+
+inline uint64_t hash_line(std::string_view s) { return hash_bytes(s.data(), s.size()); }
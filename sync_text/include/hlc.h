@@ -0,0 +1,30 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+// Hybrid logical clock for operation timestamps.
+// A timestamp packs wall-clock milliseconds (upper 48 bits) with a logical
+// counter (lower 16 bits), so plain integer comparison orders them. Local
+// events take max(physical, last) and bump the counter on ties; every received
+// timestamp is folded in with hlc_update(), so an op is always stamped after
+// anything its author had seen (causal order) even when clocks disagree.
+// Being wall-clock based, values stay comparable across processes, reboots
+// and replays of persisted ops, unlike steady_clock.
+
+constexpr int HLC_LOGICAL_BITS = 16;
+constexpr uint64_t HLC_LOGICAL_MASK = (1ull << HLC_LOGICAL_BITS) - 1;
+// Remote timestamps further ahead of our wall clock than this are not
+// adopted, so one peer with a bad clock cannot drag everyone into the future.
+// Receivers also hold back ops stamped that far ahead (see hlc_ahead()).
+constexpr uint64_t HLC_MAX_DRIFT_MS = 60 * 1000;
+
+struct Hlc {
+  std::atomic<uint64_t> last{0};
+};
+
+inline uint64_t hlc_physical_ms(uint64_t t) { return t >> HLC_LOGICAL_BITS; }
+
+// API (thread-safe: the listener updates while the main loop stamps)
+uint64_t hlc_now(Hlc &c);                  // timestamp for a local event
+void hlc_update(Hlc &c, uint64_t remote);  // fold in a received timestamp
+bool hlc_ahead(uint64_t t);                // t is beyond wall clock + HLC_MAX_DRIFT_MS
@@ -0,0 +1,77 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include "crdt.h"
+#include "document.h"
+#include "registry.h"
+
+// Late-join state transfer over the existing queues / rings.
+//
+// Every user starting up sends a JoinRequest to one live peer, carrying the
+// state vector of what it recovered from its op log (empty for a newcomer):
+// peers start a restarted user's resend window afresh, so this is how it
+// learns what happened while it was down. If that vector already covers the
+// peer's merge baseline, the peer replies with just the updates it holds but
+// has not merged yet, minus those the requester has (JOIN_OPS). Otherwise it
+// sends its merge baseline, the state vector of that baseline and those
+// unmerged updates (JOIN_FULL). The payload is LZ-compressed (compress.h)
+// and streamed as StateChunk frames:
+//   JoinRequest body: varint sender_len, sender bytes,
+//                     varint sv_count, sv_count x { varint uid_len, uid bytes, varint ts }
+//   StateChunk body:  varint sender_len, sender bytes,
+//                     varint transfer_id, varint index, varint count, chunk bytes
+// Payload before compression:
+//   u8 JOIN_FULL | JOIN_OPS
+//   varint line_count, line_count x { varint len, bytes }   (0 lines for JOIN_OPS)
+//   varint sv_count, sv_count x { varint uid_len, uid bytes, varint ts }
+//   op list (oplog_encode_ops)
+// Cost is one snapshot of the document, independent of how many operations
+// produced it. In sequence CRDT mode (rga.h) the payload is the encoded
+// sequence instead. The newcomer retries with the next peer after
+// JOIN_TIMEOUT_MS and gives up (keeping its own document) after
+// JOIN_MAX_ATTEMPTS.
+
+constexpr int JOIN_TIMEOUT_MS = 2000;
+constexpr int JOIN_MAX_ATTEMPTS = 3;
+// Upper bound on a decompressed state payload
+constexpr std::size_t JOIN_MAX_STATE = std::size_t(256) << 20;
+constexpr uint8_t JOIN_FULL = 1;
+constexpr uint8_t JOIN_OPS = 2;
+
+struct JoinState {
+  uint8_t kind = JOIN_FULL;
+  Document doc;
+  StateVector sv;
+  std::vector<UpdateExt> ops;
+  std::string payload; // decompressed transfer; ops view into it
+};
+
+// API
+// have is left out (full state requested) if it does not fit in one frame
+void join_frame_request(const char *sender, const StateVector &have, std::string &frame);
+bool join_parse_request(const char *data, std::size_t n, char sender[USER_ID_MAX], StateVector &have);
+void join_frame_state(const char *sender, uint64_t transfer_id, uint8_t kind, const Document &doc,
+                      const StateVector &sv, const std::vector<UpdateExt> &a, const std::vector<UpdateExt> &b,
+                      std::vector<std::string> &frames);
+// Compress and chunk an already encoded payload
+void join_frame_payload(const char *sender, uint64_t transfer_id, const std::string &payload,
+                        std::vector<std::string> &frames);
+
+// Collects the chunks of one transfer. A chunk of a different transfer
+// restarts collection (the newcomer asked another peer).
+struct StateAssembler {
+  std::string sender;
+  uint64_t transfer_id = 0;
+  uint64_t received = 0;
+  std::vector<std::string> parts;
+
+  // 1 when the transfer completed into out, 0 if more chunks are needed,
+  // -1 on a malformed frame or payload
+  int feed(const char *data, std::size_t n, JoinState &out);
+  // Same, stopping at the decompressed payload
+  int feed_payload(const char *data, std::size_t n, std::string &payload);
+  void reset();
+};
@@ -1,24 +1,37 @@
 #pragma once
 #include <cstdint>
 #include <cstddef>
+#include <string>
 #include "registry.h"
 
-// Operation types for updates
-enum class OpType : uint8_t { Insert = 1, Delete = 2, Replace = 3 };
+// Operation types for updates. Insert/Delete/Replace edit a column span within
+// one line; LineInsert/LineDelete add or remove a whole line at 'line',
+// shifting the lines after it (new_text / old_text hold the line's content).
+// SeqInsert/SeqDelete are character ops of the sequence CRDT (rga.h); they
+// address text by character id (ref_author, ref_ts) instead of line/column.
+enum class OpType : uint8_t {
+  Insert = 1, Delete = 2, Replace = 3, LineInsert = 4, LineDelete = 5, SeqInsert = 6, SeqDelete = 7
+};
 
-// Fixed-size message to fit typical POSIX mqueue (default msgsize often 8192)
-// Keep it small. ~600 bytes
-constexpr std::size_t TEXT_SEG_MAX = 256;
+inline bool op_is_seq(OpType op) { return op == OpType::SeqInsert || op == OpType::SeqDelete; }
 
+// In-memory form of one update. On the queue it travels in the packed,
+// variable-length encoding from wire.h, so text segments are not size-limited.
 struct UpdateMessage {
-  char sender[USER_ID_MAX];
-  uint64_t timestamp_ns; // monotonic or wallclock ns
+  uint16_t sender;       // sender's registry slot (replica id on the wire)
+  uint32_t sender_gen;   // generation of that slot when the sender registered
+  uint64_t hlc;          // hybrid logical clock timestamp (see hlc.h)
+  uint64_t epoch;        // sender's run id; seq restarts at 1 in each epoch
+  uint64_t seq;          // per-sender op sequence number (see vv.h)
   uint32_t line;
   int32_t col_start;
   int32_t col_end;
   OpType op;
-  char old_text[TEXT_SEG_MAX];
-  char new_text[TEXT_SEG_MAX];
+  std::string old_text;
+  std::string new_text;
+  // Seq ops only: insert origin / first deleted character, author by name
+  uint64_t ref_ts;
+  std::string ref_author;
 };
 
 // POSIX queue name helper: "/queue_<user_id>"
@@ -0,0 +1,62 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "crdt.h"
+#include "document.h"
+
+// Durable operation log with periodic snapshots, for fast restarts.
+//
+// <user>_ops.log is append-only: a header (magic, version, generation)
+// followed by one record per merge,
+//   u8 OPLOG_BATCH | varint body_len | varint count | count x { varint len, op }
+// holding exactly the updates handed to do_merge_apply, in order. Records are
+// buffered and written with one write() + fdatasync() per merge, not per op.
+//
+// <user>_snapshot.bin holds the merged document (the merge baseline), its
+// state vector and the highest timestamp seen, and names the log generation
+// it already covers. The state vector tells peers what a restarted editor
+// already has when it asks them to catch it up (join.h). It
+// is written by temp file + rename; the log is then restarted with the next
+// generation, so a crash between the two steps only leaves a log the snapshot
+// already covers, which is skipped on load.
+//
+// Startup maps the snapshot and replays the log tail through the same merge,
+// so the cost is bounded by OPLOG_SNAPSHOT_OPS regardless of history length.
+// A torn final record (crash mid-append) is cut off.
+
+constexpr uint32_t OPLOG_MAGIC = 0x4C4F5453;   // "STOL"
+constexpr uint32_t SNAPSHOT_MAGIC = 0x4E534F54; // "TOSN"
+constexpr uint32_t OPLOG_VERSION = 1;
+constexpr uint32_t SNAPSHOT_VERSION = 2; // 2: state vector after the lines
+constexpr uint8_t OPLOG_BATCH = 1;
+// Compact the log into a new snapshot after this many logged ops
+constexpr uint64_t OPLOG_SNAPSHOT_OPS = 4096;
+
+struct OpLog {
+  int fd = -1;
+  uint64_t gen = 0;                 // generation of the open log file
+  uint64_t ops_since_snapshot = 0;
+  uint64_t max_ts = 0;              // highest op timestamp logged or replayed
+  std::string log_path;
+  std::string snap_path;
+  std::string pending;              // encoded records not yet written
+};
+
+// API
+// Loads the snapshot and replays the log into doc and its state vector sv.
+// Returns 1 if saved state was recovered, 0 if there is none (doc and sv
+// untouched), <0 on error.
+int oplog_open(OpLog &log, const std::string &user_id, Document &doc, StateVector &sv);
+void oplog_append(OpLog &log, const std::vector<UpdateExt> &local, const std::vector<UpdateExt> &recv);
+int oplog_sync(OpLog &log);
+// Snapshot doc (with state vector sv), then start a fresh log generation
+int oplog_snapshot(OpLog &log, const Document &doc, const StateVector &sv);
+void oplog_close(OpLog &log);
+
+// Op list encoding (also used by state transfer): varint count, then
+// count x { varint len, op }. a and b are written back to back. Decoded
+// updates are views into [p, end), which must outlive them.
+void oplog_encode_ops(const std::vector<UpdateExt> &a, const std::vector<UpdateExt> &b, std::string &out);
+bool oplog_decode_ops(const char *&p, const char *end, std::vector<UpdateExt> &out);
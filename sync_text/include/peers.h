@@ -0,0 +1,62 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mqueue.h>
+#include "registry.h"
+#include "shm_ring.h"
+
+// Peer connection table keyed by registry slot.
+// Each other user's queue is opened once and the descriptor kept until the
+// slot changes owner (detected via UserEntry::generation) or a send reports
+// the descriptor is stale. Liveness is whether the queue could be opened, so
+// redraws no longer need an mq_open/mq_close per user. An open descriptor
+// outlives an unlinked queue, so live endpoints are re-opened every
+// PEER_CHECK_MS: a queue that is gone (ENOENT) marks the peer dead, one that
+// was recreated under the same name gets a fresh descriptor. Peers that
+// publish a shared-memory ring (SHM_RING_PREFIX endpoint) are attached instead.
+//
+// Each slot also carries our delivery state towards that peer, in sequence
+// numbers of our own ops (see vv.h): ops up to 'base' were issued before the
+// peer (re)registered and are not owed to it; 'sent_upto' is the highest op
+// handed to its queue, 'acked' the highest it reported contiguously received.
+// All three restart at PeerTable::local_seq when the slot changes owner.
+// The catch-up fields track a peer whose queue keeps refusing frames: it is
+// retried with exponential backoff, and given up on (vv.h, VV_STALL_MS) once
+// it has neither accepted a frame nor acked anything for that long.
+
+constexpr int PEER_CHECK_MS = 1000;
+
+struct PeerConn {
+  int active;                      // slot registered by another user
+  uint32_t generation;             // registry generation the entry was read at
+  char user_id[USER_ID_MAX];
+  char queue_name[QUEUE_NAME_MAX];
+  mqd_t mq;                        // cached O_WRONLY | O_NONBLOCK descriptor
+  ShmRing *ring;                   // mapped ring for shared-memory peers
+  bool live;                       // queue/ring currently open
+  uint64_t check_ns;               // next re-open of a live endpoint
+  uint16_t replica;                // interned user_id (replica.h)
+  uint64_t base;
+  uint64_t sent_upto;
+  uint64_t acked;
+  uint64_t acked_ns;               // when acked last advanced
+  uint64_t stall_ns;               // first refused send since the last accepted one, 0 if none
+  uint64_t retry_ns;               // next catch-up attempt
+  uint32_t retry_ms;               // current catch-up backoff
+};
+
+struct PeerTable {
+  int self_slot;
+  uint64_t local_seq;              // sequence number of our latest op
+  PeerConn peers[MAX_USERS];
+};
+
+// API
+void peers_init(PeerTable &t, int self_slot);
+// Sync the table with the registry and re-check endpoints that are due;
+// returns true if membership or liveness changed
+bool peers_refresh(PeerTable &t, const RegistrySegment *seg);
+// Send one frame; 0 on success, -1 on failure (queue/ring full or peer gone)
+int peer_send(PeerConn &p, const char *data, std::size_t n);
+PeerConn *peers_find(PeerTable &t, const char *user_id);
+void peers_close(PeerTable &t);
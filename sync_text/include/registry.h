@@ -15,6 +15,7 @@ struct UserEntry {
   volatile int active;                 // 0 = free, 1 = taken
   char user_id[USER_ID_MAX];           // null-terminated
   char queue_name[QUEUE_NAME_MAX];     // null-terminated (for Part 2)
+  volatile uint32_t generation;        // bumped on every (re)registration of the slot
 };
 
 // The registry segment layout. No locks; we rely on atomic CAS on 'active'.
@@ -26,6 +27,8 @@ struct RegistrySegment {
 
 // API
 int registry_open_or_create(int &fd, RegistrySegment *&seg);
-int registry_register(RegistrySegment *seg, const char *user_id, const char *queue_name, int &assigned_index);
+// generation receives the slot's generation after this registration
+int registry_register(RegistrySegment *seg, const char *user_id, const char *queue_name, int &assigned_index,
+                      uint32_t &generation);
 int registry_unregister(RegistrySegment *seg, const char *user_id);
 int registry_list(RegistrySegment *seg, UserEntry out_users[MAX_USERS], std::size_t &count);
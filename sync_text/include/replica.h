@@ -0,0 +1,24 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Interned user ids. Every user name this process sees maps to a small
+// replica id, which update records carry and the merge compares instead of
+// strings; the name is only looked up for display, persistence, version
+// vectors and the rare LWW timestamp tie. Ids are local to the process
+// (assigned in order of first appearance) and never reused, so at most
+// REPLICA_MAX distinct users per run: past that replica_intern returns
+// REPLICA_NONE, and records naming a new user are rejected where they are
+// decoded. Main thread only.
+//
+// On the wire an op names its sender by registry slot instead (see wire.h);
+// the receiver resolves the slot through its peer table.
+
+constexpr uint16_t REPLICA_NONE = 0xFFFF;
+constexpr std::size_t REPLICA_MAX = REPLICA_NONE; // ids 0 .. REPLICA_MAX - 1
+
+// API
+// Id of name, or REPLICA_NONE if it is new and the table is full
+uint16_t replica_intern(std::string_view name);
+std::string_view replica_name(uint16_t id);
@@ -0,0 +1,146 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "document.h"
+#include "message.h"
+
+// Character-level sequence CRDT (RGA), the alternative to the line/column
+// LWW merge, selected with SYNCTEXT_MERGE=rga.
+//
+// The document is one sequence of characters; the line structure is just the
+// '\n's in it. Every character ever inserted has an id (author, ts): an
+// insert of n characters stamped ts uses ts .. ts+n-1, and the author's clock
+// is advanced past them, so ids are unique and a character is always newer
+// than everything its author had seen when typing it. Deleted characters stay
+// as tombstones, so ops can still refer to them.
+//
+//   SeqInsert: text goes right after its origin (the character left of the
+//              cursor, or the document start), skipping concurrent inserts
+//              at the same origin that have larger ids. Every replica
+//              resolves the tie the same way, and no text is ever dropped.
+//   SeqDelete: tombstones the characters with ids ts .. ts+len-1 of one
+//              author (a local delete emits one op per such run).
+// An op whose origin or target has not arrived yet is parked under the id of
+// the character it waits for, and retried when an insert brings that
+// character. Duplicates are ignored.
+//
+// Consecutive characters of one insert are stored as a single item (run-
+// length encoded) and split only where later ops point into them. Items sit
+// in an AVL tree ordered by position, with per-subtree counts of visible
+// characters and newlines, and an id index finds the item holding a given
+// character. Applying an op is O(log n) plus the concurrent inserts it skips
+// and the lines it touches; the Document lines are patched in place, never
+// rebuilt. Each replica starts from a base text whose ids depend only on its
+// content, so replicas started from the same file share it; late joiners
+// receive the whole sequence, tombstones included (encode()).
+
+// One sequence op as applied; text is a view (inserted or deleted text, the
+// latter only for its length)
+struct SeqOp {
+  OpType op;             // SeqInsert / SeqDelete
+  uint64_t ts;           // insert: id of the first character
+  uint16_t rid;          // author, interned
+  uint64_t ref_ts;       // insert: origin (0 = document start); delete: first target
+  uint16_t ref_rid;
+  std::string_view text;
+};
+
+// A run of visible characters with consecutive ids, as found by spans()
+struct SeqSpan {
+  uint16_t rid;
+  uint64_t ts;
+  std::size_t len;
+};
+
+class SeqDoc {
+ public:
+  SeqDoc() = default;
+  SeqDoc(const SeqDoc &) = delete;
+  SeqDoc &operator=(const SeqDoc &) = delete;
+  SeqDoc(SeqDoc &&) = default; // nodes live in a deque, so links survive a move
+  SeqDoc &operator=(SeqDoc &&) = default;
+
+  // Start over from doc as the base text
+  void reset(const Document &doc);
+
+  // Current text as lines: one per '\n' plus the text after the last one
+  // (usually empty)
+  const Document &lines() const { return doc; }
+  std::size_t size() const;     // visible characters
+  std::size_t newlines() const; // visible '\n's
+  uint64_t max_ts() const { return max_ts_; }
+  std::size_t parked() const { return pending.size(); }
+
+  // Visible offset where line l starts; npos when l > newlines()
+  std::size_t line_start(std::size_t l) const;
+  // Origin for an insert at visible offset p (the character before it)
+  void origin_at(std::size_t p, uint64_t &ref_ts, uint16_t &ref_rid) const;
+  // Ids of the n visible characters from offset p, as maximal runs
+  void spans(std::size_t p, std::size_t n, std::vector<SeqSpan> &out) const;
+
+  // Apply one op; ops that cannot be applied yet are parked (their text
+  // copied). Returns whether the visible text changed.
+  bool apply(const SeqOp &op);
+
+  // Join transfer: the full sequence, tombstones included, then the parked
+  // ops and extra (ops received but not applied yet), which decode() applies
+  void encode(std::string &out, const std::vector<SeqOp> &extra) const;
+  bool decode(const char *&p, const char *end);
+
+ private:
+  struct Node {
+    Node *left = nullptr;
+    Node *right = nullptr;
+    Node *parent = nullptr;
+    int height = 1;
+    uint64_t ts;       // id of the first character
+    uint16_t rid;
+    uint32_t len;      // characters, tombstoned or not
+    bool deleted;
+    std::string text;  // empty once deleted
+    uint32_t text_nl;  // '\n's in text
+    std::size_t vis;   // visible characters in this subtree
+    std::size_t nl;    // visible '\n's in this subtree
+  };
+  struct Parked {
+    OpType op;
+    uint64_t ts;
+    uint16_t rid;
+    uint64_t ref_ts;
+    uint16_t ref_rid;
+    std::string text;
+  };
+
+  static std::size_t vis_of(const Node *n) { return n ? n->vis : 0; }
+  static std::size_t nl_of(const Node *n) { return n ? n->nl : 0; }
+  static int height_of(const Node *n) { return n ? n->height : 0; }
+  static void update(Node *n);
+  static Node *next(Node *n);
+  void rotate(Node *n); // n takes its parent's place
+  void rebalance(Node *n);
+  void link_after(Node *pos, Node *x); // pos == nullptr: first
+  Node *make(uint64_t ts, uint16_t rid, std::string text, bool deleted, uint32_t len);
+  Node *first() const;
+  Node *find(uint16_t rid, uint64_t ts, std::size_t &off) const;
+  Node *split(Node *n, std::size_t off);
+  Node *at_visible(std::size_t p, std::size_t &off) const;
+  void prefix(const Node *n, std::size_t &vis, std::size_t &nl) const;
+  void refresh_lines(std::size_t l, std::size_t old_count, std::size_t new_count);
+  bool greater(const Node *n, uint64_t ts, uint16_t rid) const;
+  using Id = std::pair<uint16_t, uint64_t>; // (rid, ts) of one character
+  // 1 changed, 0 no-op, -1 dependency missing (the first absent id in missing)
+  int try_apply(const SeqOp &op, Id &missing);
+
+  Node *root = nullptr;
+  std::deque<Node> nodes;                                  // stable addresses
+  std::map<std::pair<uint16_t, uint64_t>, Node *> index;   // (rid, first ts) -> item
+  std::multimap<Id, Parked> pending;                       // by the id each op waits for
+  Document doc;
+  uint64_t max_ts_ = 0;
+};
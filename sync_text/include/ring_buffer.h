@@ -0,0 +1,101 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+// Lock-free single-producer / single-consumer ring buffer.
+//
+// head and tail run freely and are masked into the power-of-two slot array,
+// so all CAP slots are usable and no modulo is needed. Each index sits on its
+// own cache line together with the owning side's cached copy of the other
+// index: the producer re-reads tail (and the consumer head) only when its
+// cached value says the ring looks full (empty), so in steady state each side
+// touches the shared line of the other once per wrap instead of once per op.
+
+constexpr std::size_t RING_CACHE_LINE = 64;
+
+template <typename T, std::size_t CAP>
+struct RingBuffer {
+  static_assert(CAP >= 2 && (CAP & (CAP - 1)) == 0, "RingBuffer capacity must be a power of two");
+  static constexpr std::size_t MASK = CAP - 1;
+
+  // Producer side
+  alignas(RING_CACHE_LINE) std::atomic<std::size_t> head{0};
+  std::size_t tail_cache = 0;
+  // Consumer side
+  alignas(RING_CACHE_LINE) std::atomic<std::size_t> tail{0};
+  std::size_t head_cache = 0;
+  alignas(RING_CACHE_LINE) T data[CAP];
+
+  // Producer: free slots, refreshing the cached tail only when needed
+  std::size_t free_slots(std::size_t h, std::size_t want) {
+    std::size_t room = CAP - (h - tail_cache);
+    if (room < want) {
+      tail_cache = tail.load(std::memory_order_acquire);
+      room = CAP - (h - tail_cache);
+    }
+    return room;
+  }
+  // Consumer: filled slots, refreshing the cached head only when needed
+  std::size_t filled_slots(std::size_t t, std::size_t want) {
+    std::size_t avail = head_cache - t;
+    if (avail < want) {
+      head_cache = head.load(std::memory_order_acquire);
+      avail = head_cache - t;
+    }
+    return avail;
+  }
+
+  template <typename U>
+  bool push(U &&v) {
+    std::size_t h = head.load(std::memory_order_relaxed);
+    if (free_slots(h, 1) == 0) return false; // full
+    data[h & MASK] = std::forward<U>(v);
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+  bool pop(T &out) {
+    std::size_t t = tail.load(std::memory_order_relaxed);
+    if (filled_slots(t, 1) == 0) return false; // empty
+    out = std::move(data[t & MASK]);
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+  // Bulk forms publish once per call; they move up to n items and return
+  // how many were moved
+  std::size_t push_n(T *in, std::size_t n) {
+    std::size_t h = head.load(std::memory_order_relaxed);
+    std::size_t k = free_slots(h, n);
+    if (k > n) k = n;
+    for (std::size_t i = 0; i < k; ++i) data[(h + i) & MASK] = std::move(in[i]);
+    if (k > 0) head.store(h + k, std::memory_order_release);
+    return k;
+  }
+  std::size_t pop_n(T *out, std::size_t n) {
+    std::size_t t = tail.load(std::memory_order_relaxed);
+    std::size_t k = filled_slots(t, n);
+    if (k > n) k = n;
+    for (std::size_t i = 0; i < k; ++i) out[i] = std::move(data[(t + i) & MASK]);
+    if (k > 0) tail.store(t + k, std::memory_order_release);
+    return k;
+  }
+  // In-place forms for large slots: the producer fills the slot returned by
+  // reserve() and publishes it with commit(); the consumer reads front() and
+  // frees it with release(). reserve() / front() return nullptr when the
+  // ring is full / empty.
+  T *reserve() {
+    std::size_t h = head.load(std::memory_order_relaxed);
+    return free_slots(h, 1) > 0 ? &data[h & MASK] : nullptr;
+  }
+  void commit() { head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+  T *front() {
+    std::size_t t = tail.load(std::memory_order_relaxed);
+    return filled_slots(t, 1) > 0 ? &data[t & MASK] : nullptr;
+  }
+  void release() { tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+  // Approximate from any thread
+  std::size_t size() const {
+    std::size_t t = tail.load(std::memory_order_acquire);
+    return head.load(std::memory_order_acquire) - t;
+  }
+};
@@ -0,0 +1,74 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "wire.h"
+
+// Shared-memory transport: each user owns one multi-producer / single-consumer
+// ring in /dev/shm that peers write frames into directly (one copy, no
+// syscall on the fast path). Slots carry a per-slot sequence number (bounded
+// MPMC queue after D. Vyukov), so producers from different processes only
+// contend on the slot at the enqueue position. A futex word wakes the owner's
+// listener; the FUTEX_WAKE syscall is skipped unless the listener is
+// actually asleep.
+//
+// A producer that dies between claiming a slot and publishing it would stall
+// the consumer on that slot for good. Producers claim a slot by swapping its
+// sequence number for a claim word holding their pid, so a claimed slot
+// always names its producer; enqueue_pos is advanced after the claim, by the
+// claimer or by whoever finds the slot claimed first. A slot left
+// unpublished for SHM_RING_STALL_MS whose producer is gone is skipped (its
+// frame is lost, and the sender's resend covers it).
+//
+// Selected at startup with SYNCTEXT_TRANSPORT=shm. The ring's name is
+// published in the registry's queue_name field, so senders pick the transport
+// per receiver from the endpoint name.
+
+#define SHM_RING_PREFIX "/synctext_ring_"
+
+constexpr std::size_t SHM_RING_SLOTS = 64; // power of two
+static_assert((SHM_RING_SLOTS & (SHM_RING_SLOTS - 1)) == 0, "SHM_RING_SLOTS must be a power of two");
+// How long a claimed slot may stay unpublished before its owner is checked
+constexpr int SHM_RING_STALL_MS = 1000;
+
+// Claim word: SHM_RING_CLAIMED | pid << 32 | low 32 bits of the position
+constexpr uint64_t SHM_RING_CLAIMED = uint64_t(1) << 63;
+
+struct ShmRingSlot {
+  std::atomic<uint64_t> seq;  // position when free, position + 1 when published, or a claim word
+  uint32_t len;
+  char data[WIRE_MSG_MAX];
+};
+
+struct ShmRing {
+  uint32_t magic;
+  uint32_t version;
+  alignas(64) std::atomic<uint64_t> enqueue_pos;  // shared by producers
+  alignas(64) std::atomic<uint64_t> dequeue_pos;  // owned by the consumer
+  uint64_t stall_pos;                             // consumer: slot waited on + 1, 0 if none
+  uint64_t stall_since_ns;
+  alignas(64) std::atomic<uint32_t> futex_word;   // bumped after every push
+  std::atomic<uint32_t> sleeping;                 // consumer is in futex_wait
+  ShmRingSlot slots[SHM_RING_SLOTS];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring needs address-free 64-bit atomics");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "ring needs address-free 32-bit atomics");
+
+// API
+bool is_shm_endpoint(const char *name);
+int shm_ring_create(const char *name, ShmRing *&ring);  // owner; replaces any stale ring
+int shm_ring_attach(const char *name, ShmRing *&ring);  // peer
+void shm_ring_detach(ShmRing *ring);
+// Producer side: 0 on success, -1 if the ring is full or n > WIRE_MSG_MAX
+int shm_ring_push(ShmRing *ring, const char *data, std::size_t n);
+// Consumer side: frame length, or -1 if the ring is empty or the next slot
+// is not published yet
+long shm_ring_pop(ShmRing *ring, char *buf, std::size_t cap);
+// Consumer side: a slot is claimed but not published (wait with a timeout,
+// so an abandoned slot is noticed)
+bool shm_ring_stalled(const ShmRing *ring);
+// Consumer side: sleep until a push happens after futex_word read 'seen'
+void shm_ring_wait(ShmRing *ring, uint32_t seen, int timeout_ms);
+// Wake the consumer without pushing (used for shutdown)
+void shm_ring_wake(ShmRing *ring);
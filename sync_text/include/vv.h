@@ -0,0 +1,70 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include "registry.h"
+
+// Version vectors and delta sync between peers.
+//
+// Every op carries its author's (epoch, seq): epoch is fixed per run (an HLC
+// stamp taken at startup, so a restarted editor is always newer) and seq
+// counts the author's ops from 1. A receiver keeps, per author, the next seq
+// it expects and accepts only that one: older ones are duplicates of ops
+// already delivered, newer ones mean something in between was lost, and the
+// op is dropped so the sender can resend the gap in order (go-back-N).
+//
+// The sender keeps its recent ops in a history and, per peer, how far it has
+// sent and how far the peer confirmed. Peers exchange VersionVector frames
+// every VV_SYNC_MS while anything is unconfirmed in either direction:
+//   body: varint sender_len, sender bytes, varint epoch,
+//         varint head (last seq sent), varint floor (ops <= floor can no
+//         longer be resent), u8 nack,
+//         varint count, count x { varint uid_len, uid bytes, varint epoch,
+//                                 varint received (contiguous seq) }
+// A peer that sees a head beyond what it holds, or a gap in the op stream,
+// answers with a nack and the sender retransmits only the missing range.
+// Steady state costs nothing extra: ops are sent once, and an idle session
+// exchanges no summaries at all.
+
+constexpr int VV_SYNC_MS = 1000;
+// Own ops retained for retransmission (older ones are trimmed once every
+// peer confirmed them, or when the history outgrows this)
+constexpr std::size_t VV_HISTORY_MAX = 65536;
+// Ops per batch when catching a peer up; a batch that does not fit in the
+// peer's queue is retried after VV_RETRY_MS, doubling up to VV_RETRY_MAX_MS
+// while the queue stays full
+constexpr std::size_t VV_RESEND_MAX = 128;
+constexpr int VV_RETRY_MS = 5;
+constexpr int VV_RETRY_MAX_MS = 250;
+// A peer whose queue has refused frames for this long, with no ack in that
+// time either, has stopped reading (or crashed with its queue still open):
+// it is no longer retried, waited for in sync rounds, or allowed to pin the
+// history. Its next ack or accepted frame brings it back.
+constexpr int VV_STALL_MS = 10000;
+
+struct SeqTrack {
+  uint64_t epoch = 0;
+  uint64_t next = 1;   // first seq not yet delivered
+};
+using VersionVector = std::map<std::string, SeqTrack, std::less<>>; // looked up by string_view
+
+enum class VvAdmit { Accept, Duplicate, Gap, Stale };
+
+struct VvSummary {
+  char sender[USER_ID_MAX];
+  uint64_t epoch;
+  uint64_t head;
+  uint64_t floor;
+  bool nack;
+  VersionVector entries; // next = received + 1
+};
+
+// API
+// Classify an incoming op and advance the vector when it is accepted. The
+// first op of an unknown author or of a newer epoch starts tracking there.
+VvAdmit vv_admit(VersionVector &vv, std::string_view uid, uint64_t epoch, uint64_t seq);
+void vv_frame(const char *sender, uint64_t epoch, uint64_t head, uint64_t floor, bool nack,
+              const VersionVector &vv, std::string &frame);
+bool vv_parse(const char *data, std::size_t n, VvSummary &out);
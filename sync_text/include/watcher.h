@@ -0,0 +1,32 @@
+#pragma once
+#include <cstdint>
+
+// Event-driven document watcher for the editor main loop.
+// inotify watches the directory containing the document (so atomic-rename saves
+// are seen too) and an eventfd lets other threads wake the main loop. Both are
+// multiplexed with epoll. If inotify is unavailable (or SYNCTEXT_POLL is set)
+// the watcher falls back to the original 2-second polling interval.
+
+// Bits returned by watcher_wait
+constexpr uint32_t WATCH_FILE = 1u << 0;   // document may have changed
+constexpr uint32_t WATCH_WAKE = 1u << 1;   // watcher_notify() was called
+constexpr uint32_t WATCH_TIMEOUT = 1u << 2;
+
+// Polling interval used in fallback mode (and as the upper bound on how long
+// the event loop sleeps before re-reading the registry)
+constexpr int WATCH_POLL_MS = 2000;
+
+struct DocWatcher {
+  int epfd = -1;
+  int inotify_fd = -1;
+  int wd = -1;
+  int wake_fd = -1;          // eventfd, written by watcher_notify()
+  bool polling = false;      // true when running in stat() polling fallback
+  char name[256] = {0};      // basename of the watched document
+};
+
+// API
+int watcher_open(DocWatcher &w, const char *path);
+uint32_t watcher_wait(DocWatcher &w, int timeout_ms);
+void watcher_notify(DocWatcher &w);
+void watcher_close(DocWatcher &w);
@@ -0,0 +1,124 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "message.h"
+
+// Packed wire format for updates sent over the message queues.
+//
+// Every queue message is one frame:
+//   u8 WIRE_MAGIC | u8 FrameKind | body
+// Op body:
+//   varint sender (registry slot of the author + MAX_USERS x the slot's
+//                  generation, so frames outliving their author's
+//                  registration are not credited to the slot's next owner)
+//   varint hlc, varint epoch, varint seq, varint line
+//   zigzag varint col_start, zigzag varint col_end
+//   u8 op
+//   varint old_len, old bytes, varint new_len, new bytes
+//   SeqInsert / SeqDelete only: varint ref_len, ref_author bytes, varint ref_ts
+// Batch body (several updates in one queue message):
+//   repeated { varint body_len, Op body } until the end of the frame
+// Fragment body (an Op body too large for one queue message):
+//   varint sender (as in the Op body)
+//   varint msg_id, varint index, varint count, chunk bytes
+//   (count is bounded by WIRE_OP_MAX, so a frame cannot make the receiver
+//   allocate more than one op's worth of parts)
+// A one-character insert costs ~25 bytes instead of a fixed ~600.
+// JoinRequest / StateChunk are control frames for late-join state transfer,
+// VersionVector the anti-entropy summary; their bodies are defined in join.h
+// and vv.h and they bypass WireReassembler.
+
+// Queue message size; larger op bodies are split into fragments
+constexpr std::size_t WIRE_MSG_MAX = 1024;
+constexpr uint8_t WIRE_MAGIC = 0xA7;
+// Incomplete fragmented updates kept per receiver before the oldest is dropped
+constexpr std::size_t WIRE_MAX_PENDING = 16;
+// Largest op body sent as fragments; receivers reject fragment frames that
+// announce more chunks than it takes
+constexpr std::size_t WIRE_OP_MAX = std::size_t(16) << 20;
+// Upper bound on an op body besides its old/new text (varint fields, the
+// SeqInsert / SeqDelete reference)
+constexpr std::size_t WIRE_OP_OVERHEAD = 256;
+
+// Whether an op carrying text_bytes of old + new text can be sent. Larger
+// local edits must be refused: peers would drop them, and the resend path
+// would retry them forever.
+inline bool wire_op_fits(std::size_t text_bytes) {
+  return text_bytes <= WIRE_OP_MAX - WIRE_OP_OVERHEAD;
+}
+
+// Fragment header: magic, kind, sender, msg_id, index, count (<= 2+3+3*10 bytes)
+constexpr std::size_t WIRE_FRAGMENT_CHUNK = WIRE_MSG_MAX - (2 + 3 + 3 * 10);
+
+enum class FrameKind : uint8_t {
+  Op = 1, Fragment = 2, Batch = 3, JoinRequest = 4, StateChunk = 5, VersionVector = 6
+};
+
+inline bool wire_is_control(const char *data, std::size_t n) {
+  return n >= 2 && static_cast<uint8_t>(data[0]) == WIRE_MAGIC &&
+         static_cast<uint8_t>(data[1]) >= static_cast<uint8_t>(FrameKind::JoinRequest) &&
+         static_cast<uint8_t>(data[1]) <= static_cast<uint8_t>(FrameKind::VersionVector);
+}
+
+// Primitive encoders / decoders. Decoders advance p and fail on truncation.
+void wire_put_varint(std::string &out, uint64_t v);
+bool wire_get_varint(const char *&p, const char *end, uint64_t &v);
+void wire_put_bytes(std::string &out, const char *data, std::size_t n);
+bool wire_get_bytes(const char *&p, const char *end, const char *&data, std::size_t &n);
+
+// An op decoded in place: the views point into the frame (or the
+// reassembler's buffer) it was decoded from
+struct UpdateView {
+  uint16_t sender;       // registry slot
+  uint32_t sender_gen;   // its generation when the author registered
+  uint64_t hlc;
+  uint64_t epoch;
+  uint64_t seq;
+  uint32_t line;
+  int32_t col_start;
+  int32_t col_end;
+  OpType op;
+  std::string_view old_text;
+  std::string_view new_text;
+  uint64_t ref_ts;
+  std::string_view ref_author;
+};
+
+// Op body (no frame header)
+void wire_encode_op(const UpdateMessage &m, std::string &out);
+bool wire_decode_view(const char *p, std::size_t n, UpdateView &v);
+bool wire_decode_op(const char *p, std::size_t n, UpdateMessage &m);
+
+// Encode one update as one or more frames of at most WIRE_MSG_MAX bytes.
+// msg_id must be unique per sender among updates in flight. False, with no
+// frames added, if the op body is over WIRE_OP_MAX.
+bool wire_frame_update(const UpdateMessage &m, uint64_t msg_id, std::vector<std::string> &frames);
+
+// Encode several updates, packing as many as fit into each Batch frame.
+// Updates too large for a frame on their own are fragmented, consuming ids
+// from next_msg_id. Frames keep the order of ops. Typical broadcasts produce
+// a single frame. False if an op was over WIRE_OP_MAX and left out.
+bool wire_frame_batch(const std::vector<UpdateMessage> &ops, uint64_t &next_msg_id,
+                      std::vector<std::string> &frames);
+
+// Receiver side: turns frames back into updates, reassembling fragments
+struct WireReassembler {
+  struct Pending {
+    uint16_t sender;
+    uint32_t sender_gen;
+    uint64_t msg_id;
+    uint64_t count;
+    uint64_t received;
+    std::vector<std::string> parts;
+  };
+  std::vector<Pending> pending;
+  std::string assembled; // body of the last completed fragmented update
+
+  // Decode one received frame without copying; completed updates are
+  // appended to out and stay valid while the frame does and until the next
+  // feed(). Returns false if the frame is malformed.
+  bool feed(const char *data, std::size_t n, std::vector<UpdateView> &out);
+};
@@ -0,0 +1,61 @@
+#include "../include/compress.h"
+#include "../include/wire.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+static constexpr int LZ_HASH_BITS = 14;
+
+static uint32_t hash4(const char *p) {
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+void lz_compress(const char *src, std::size_t n, std::string &out) {
+  out.clear();
+  out.reserve(n / 2 + 16);
+  std::vector<uint32_t> table(std::size_t(1) << LZ_HASH_BITS, 0); // position + 1, 0 = empty
+  std::size_t anchor = 0;
+  std::size_t i = 0;
+  while (i + LZ_MIN_MATCH <= n) {
+    uint32_t h = hash4(src + i);
+    std::size_t cand = table[h];
+    table[h] = static_cast<uint32_t>(i + 1);
+    if (cand == 0 || std::memcmp(src + cand - 1, src + i, LZ_MIN_MATCH) != 0) {
+      ++i;
+      continue;
+    }
+    std::size_t from = cand - 1;
+    std::size_t len = LZ_MIN_MATCH;
+    while (i + len < n && src[from + len] == src[i + len]) ++len;
+
+    wire_put_bytes(out, src + anchor, i - anchor);
+    wire_put_varint(out, len);
+    wire_put_varint(out, i - from);
+    i += len;
+    anchor = i;
+  }
+  wire_put_bytes(out, src + anchor, n - anchor);
+  wire_put_varint(out, 0);
+}
+
+bool lz_decompress(const char *src, std::size_t n, std::string &out, std::size_t max_out) {
+  out.clear();
+  const char *p = src;
+  const char *end = src + n;
+  for (;;) {
+    const char *lit;
+    std::size_t lit_n;
+    uint64_t len, off;
+    if (!wire_get_bytes(p, end, lit, lit_n) || out.size() + lit_n > max_out) return false;
+    out.append(lit, lit_n);
+    if (!wire_get_varint(p, end, len)) return false;
+    if (len == 0) return p == end;
+    if (!wire_get_varint(p, end, off) || off == 0 || off > out.size() || len > max_out - out.size()) return false;
+    // Byte-wise: a match may overlap the bytes it produces (runs)
+    std::size_t from = out.size() - static_cast<std::size_t>(off);
+    for (uint64_t k = 0; k < len; ++k) out.push_back(out[from + k]);
+  }
+}
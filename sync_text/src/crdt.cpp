@@ -1,6 +1,56 @@
 #include "../include/crdt.h"
+#include "../include/replica.h"
 #include <algorithm>
+#include <cstring>
+#include <functional>
 #include <map>
+#include <set>
+#include <string_view>
+#include <unordered_map>
+
+std::string_view MergeArena::store(std::string_view s) {
+  if (s.empty()) return {};
+  if (chunks.empty() || used + s.size() > chunks.back().size) {
+    std::size_t size = std::max(ARENA_CHUNK, s.size());
+    chunks.push_back(Chunk{std::unique_ptr<char[]>(new char[size]), size});
+    used = 0;
+  }
+  char *dst = chunks.back().data.get() + used;
+  std::memcpy(dst, s.data(), s.size());
+  used += s.size();
+  return std::string_view(dst, s.size());
+}
+
+void MergeArena::clear() {
+  if (!chunks.empty() && chunks.front().size == ARENA_CHUNK) chunks.resize(1);
+  else chunks.clear();
+  used = 0;
+}
+
+UpdateExt update_store(MergeArena &arena, const UpdateExt &u) {
+  UpdateExt e = u;
+  e.old_text = arena.store(u.old_text);
+  e.new_text = arena.store(u.new_text);
+  return e;
+}
+
+void state_vector_add(StateVector &sv, const std::vector<UpdateExt> &ops) {
+  for (const auto &u : ops) {
+    std::string_view uid = replica_name(u.rid);
+    auto it = sv.find(uid);
+    if (it == sv.end()) sv.emplace(std::string(uid), u.ts);
+    else if (u.ts > it->second) it->second = u.ts;
+  }
+}
+
+bool state_vector_covers(const StateVector &sv, const UpdateExt &u) {
+  auto it = sv.find(replica_name(u.rid));
+  return it != sv.end() && u.ts <= it->second;
+}
+
+static bool is_structural(OpType op) {
+  return op == OpType::LineInsert || op == OpType::LineDelete;
+}
 
 // Check if two updates overlap (conflict)
 bool overlaps(const UpdateExt &a, const UpdateExt &b) {
@@ -18,142 +68,377 @@ bool overlaps(const UpdateExt &a, const UpdateExt &b) {
   return !(a_end <= b.cs || b_end <= a.cs);
 }
 
-// LWW: newer timestamp wins, tie-break by smaller user_id
+// LWW: later HLC timestamp wins, tie-break by smaller user_id. Replica ids
+// are per process, so the tie compares names to agree across peers.
 bool newer_wins(const UpdateExt &a, const UpdateExt &b) {
   if (a.ts != b.ts) return a.ts > b.ts;
-  return a.uid < b.uid;
+  return a.rid != b.rid && replica_name(a.rid) < replica_name(b.rid);
+}
+
+// Write cur with a run of updates into out in one pass. Updates are in
+// column order and refer to cur's original columns; each one replaces
+// old_text.size() characters at cs (none for an insert). A column before the
+// end of the previous replacement, or past the end of the line, is clamped so
+// the copy only moves forward.
+void splice_line(const std::string &cur, const UpdateExt *first, const UpdateExt *last, std::string &out) {
+  size_t extra = 0;
+  for (const UpdateExt *u = first; u != last; ++u) extra += u->new_text.size();
+  out.clear();
+  out.reserve(cur.size() + extra);
+  size_t pos = 0;
+  for (const UpdateExt *u = first; u != last; ++u) {
+    size_t start = std::min(std::max(static_cast<size_t>(std::max(0, u->cs)), pos), cur.size());
+    size_t end = std::min(start + u->old_text.size(), cur.size());
+    out.append(cur, pos, start - pos);
+    out.append(u->new_text);
+    pos = end;
+  }
+  out.append(cur, pos, std::string::npos);
 }
 
 // Apply a single update to a line
-// For LWW CRDT, we reconstruct the line by applying the update's transformation
 std::string apply_update_to_line(const std::string &cur, const UpdateExt &u) {
-  // Handle empty line case
-  if (cur.empty()) {
-    return u.new_text;
+  std::string result;
+  splice_line(cur, &u, &u + 1, result);
+  return result;
+}
+
+// Key of an open update chain: the next update of the chain must be on the
+// same line/column, from the same user, and replace exactly this text
+struct ChainKey {
+  uint32_t line;
+  int cs;
+  uint16_t rid;
+  std::string_view text;
+  bool operator==(const ChainKey &o) const {
+    return line == o.line && cs == o.cs && rid == o.rid && text == o.text;
   }
-  
-  // Ensure positions are within bounds
-  int start = std::max(0, static_cast<int>(u.cs));
-  int end = std::min(static_cast<int>(u.ce), static_cast<int>(cur.length()) - 1);
-  
-  // Handle invalid range (start > end)
-  if (start > end) {
-    return cur;
+};
+
+struct ChainKeyHash {
+  size_t operator()(const ChainKey &k) const {
+    size_t h = std::hash<std::string_view>()(k.text);
+    h ^= static_cast<size_t>(k.rid) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    h ^= (static_cast<size_t>(k.line) << 32 | static_cast<uint32_t>(k.cs)) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    return h;
   }
-  
-  // Apply the update
-  std::string result = cur.substr(0, start) + u.new_text;
-  if (end >= 0 && static_cast<size_t>(end + 1) < cur.size()) {
-    result += cur.substr(end + 1);
+};
+
+// Check u against the accepted updates of its line, mirroring overlaps():
+// non-empty ranges conflict when they intersect, an insert conflicts with an
+// insert at the same column or with a range strictly containing its column.
+static bool conflicts_with_accepted(const UpdateExt &u, const std::map<int, int> &ranges,
+                                    const std::set<int> &insert_points) {
+  int u_end = u.cs + static_cast<int>(u.old_text.size());
+  if (u.old_text.empty()) {
+    if (insert_points.count(u.cs)) return true;
+    auto it = ranges.lower_bound(u.cs);
+    if (it == ranges.begin()) return false;
+    --it; // last range starting before u.cs
+    return it->second > u.cs;
+  }
+  auto ip = insert_points.upper_bound(u.cs);
+  if (ip != insert_points.end() && *ip < u_end) return true;
+  auto it = ranges.lower_bound(u.cs);
+  if (it != ranges.end() && it->first < u_end) return true;
+  if (it != ranges.begin()) {
+    --it;
+    if (it->second > u.cs) return true;
+  }
+  return false;
+}
+
+// Sort updates by (line, column ascending, timestamp descending): each line's
+// updates form a contiguous run, in the order they are applied
+static void sort_line_updates(std::vector<UpdateExt> &updates) {
+  std::sort(updates.begin(), updates.end(), [](const UpdateExt &a, const UpdateExt &b) {
+    if (a.line != b.line) return a.line < b.line;
+    if (a.cs != b.cs) return a.cs < b.cs;
+    return a.ts > b.ts; // Newer timestamps come first for same position
+  });
+}
+
+// End of the run of sorted updates starting at first (all on one line)
+static size_t line_run_end(const std::vector<UpdateExt> &updates, size_t first) {
+  size_t last = first + 1;
+  while (last < updates.size() && updates[last].line == updates[first].line) ++last;
+  return last;
+}
+
+// Apply a set of intra-line updates that all refer to the same document
+// layout (no line inserts/deletes in between). Sorts updates in place.
+static void apply_line_updates(Document &lines, std::vector<UpdateExt> &updates) {
+  sort_line_updates(updates);
+  // Splice each run into its line
+  size_t last = 0;
+  for (size_t first = 0; first < updates.size(); first = last) {
+    uint32_t line_num = updates[first].line;
+    last = line_run_end(updates, first);
+    while (lines.size() <= line_num) lines.push_back("");
+
+    std::string out;
+    splice_line(lines[line_num], updates.data() + first, updates.data() + last, out);
+    lines.set(line_num, std::move(out));
+  }
+}
+
+// Line layout of a batch with line inserts/deletes. Every author numbers
+// lines in its own view: the baseline plus its own earlier ops, not the
+// concurrent ones of other authors. Lines are tracked as entries with ids
+// (baseline lines 0..n-1, inserted and padding lines from n on), kept as
+// runs in document order. A run records whether its lines are still in the
+// merged document and which authors' views contain them, so an author's line
+// number maps to an entry by counting only the runs it sees. Deleted lines
+// stay as entries until the batch is applied, since other authors' ops may
+// still refer to them.
+struct LineRun {
+  uint32_t id;   // entry id of the first line; ids are consecutive within a run
+  uint32_t len;
+  bool visible;  // not deleted
+  uint64_t seen; // bit per author whose view contains these lines
+};
+
+struct LineLayout {
+  std::vector<LineRun> runs;
+  uint32_t base;                       // baseline lines: entries 0..base-1
+  std::vector<std::string_view> added; // text of entries base.. (padding lines are empty)
+};
+
+// Run index of the l-th line of an author's view, split so that the line
+// starts its run; runs.size() when the view has no such line
+static size_t layout_split(LineLayout &lay, uint64_t bit, uint32_t l) {
+  for (size_t r = 0; r < lay.runs.size(); ++r) {
+    if (!(lay.runs[r].seen & bit)) continue;
+    if (l >= lay.runs[r].len) {
+      l -= lay.runs[r].len;
+      continue;
+    }
+    if (l > 0) {
+      LineRun tail = lay.runs[r];
+      tail.id += l;
+      tail.len -= l;
+      lay.runs[r].len = l;
+      lay.runs.insert(lay.runs.begin() + static_cast<std::ptrdiff_t>(++r), tail);
+    }
+    return r;
+  }
+  return lay.runs.size();
+}
+
+// Entry id of the l-th line of an author's view. A view shorter than l lines
+// is padded with empty lines first (as apply_line_updates does).
+static uint32_t layout_entry(LineLayout &lay, uint64_t bit, uint32_t l) {
+  for (const auto &run : lay.runs) {
+    if (!(run.seen & bit)) continue;
+    if (l < run.len) return run.id + l;
+    l -= run.len;
+  }
+  uint32_t id = lay.base + static_cast<uint32_t>(lay.added.size());
+  lay.runs.push_back(LineRun{id, l + 1, true, ~uint64_t(0)});
+  lay.added.resize(lay.added.size() + l + 1);
+  return id + l;
+}
+
+// Line insert: a new entry in the author's view. A concurrent insert of the
+// same text at the same place (between the same two lines of this view) is
+// taken as the same line, so it is not duplicated.
+static void layout_insert(LineLayout &lay, uint64_t bit, uint32_t l, std::string_view text) {
+  size_t r = layout_split(lay, bit, l);
+  for (size_t k = r; k-- > 0 && !(lay.runs[k].seen & bit);) {
+    const LineRun &run = lay.runs[k];
+    if (run.visible && run.id >= lay.base && run.len == 1 && lay.added[run.id - lay.base] == text) {
+      lay.runs[k].seen |= bit;
+      return;
+    }
+  }
+  uint32_t id = lay.base + static_cast<uint32_t>(lay.added.size());
+  lay.added.push_back(text);
+  lay.runs.insert(lay.runs.begin() + static_cast<std::ptrdiff_t>(r), LineRun{id, 1, true, bit});
+}
+
+// Line delete: the line leaves the author's view and the document (a line
+// another author already deleted is deleted once)
+static void layout_delete(LineLayout &lay, uint64_t bit, uint32_t l) {
+  size_t r = layout_split(lay, bit, l);
+  if (r == lay.runs.size()) return;
+  if (lay.runs[r].len > 1) layout_split(lay, bit, l + 1);
+  lay.runs[r].visible = false;
+  lay.runs[r].seen &= ~bit;
+}
+
+// Write the layout into lines (which holds the baseline), splicing in the
+// intra-line updates, whose line fields are entry ids. Baseline runs stay in
+// id order, so their updates are found by binary search; only changed lines
+// are touched.
+static void layout_apply(Document &lines, const LineLayout &lay, std::vector<UpdateExt> &updates) {
+  sort_line_updates(updates);
+  auto first_at = [&](uint32_t id) {
+    return static_cast<size_t>(std::lower_bound(updates.begin(), updates.end(), id,
+                                                [](const UpdateExt &u, uint32_t v) { return u.line < v; }) -
+                               updates.begin());
+  };
+  std::string out;
+  size_t d = 0; // document index of the next entry
+  for (const auto &run : lay.runs) {
+    if (!run.visible) {
+      if (run.id < lay.base) {
+        for (uint32_t k = 0; k < run.len; ++k) lines.erase(d);
+      }
+      continue;
+    }
+    if (run.id < lay.base) {
+      for (size_t first = first_at(run.id), last; first < updates.size() && updates[first].line < run.id + run.len;
+           first = last) {
+        last = line_run_end(updates, first);
+        size_t at = d + (updates[first].line - run.id);
+        splice_line(lines[at], updates.data() + first, updates.data() + last, out);
+        lines.set(at, std::move(out));
+      }
+      d += run.len;
+      continue;
+    }
+    for (uint32_t k = 0; k < run.len; ++k) {
+      std::string text(lay.added[run.id + k - lay.base]);
+      size_t first = first_at(run.id + k);
+      if (first < updates.size() && updates[first].line == run.id + k) {
+        splice_line(text, updates.data() + first, updates.data() + line_run_end(updates, first), out);
+        text = std::move(out);
+      }
+      lines.insert(d++, std::move(text));
+    }
   }
-  return result;
 }
 
 // CRDT merge algorithm with LWW conflict resolution
 // Per assignment: detect conflicts (same line + overlapping columns), resolve via LWW,
 // then apply ALL surviving updates. Non-conflicting updates commute.
-bool do_merge_apply(std::vector<std::string> &lines, 
+bool do_merge_apply(Document &lines,
                     std::vector<UpdateExt> &local_unmerged,
                     std::vector<UpdateExt> &recv_unmerged,
                     const std::string &self_uid) {
   (void)self_uid;
   if (local_unmerged.empty() && recv_unmerged.empty()) return false;
 
-  // Step 1: Combine all updates (local + remote)
-  std::vector<UpdateExt> all;
-  all.reserve(local_unmerged.size() + recv_unmerged.size());
-  all.insert(all.end(), local_unmerged.begin(), local_unmerged.end());
+  // Step 1: Combine all updates (local + remote). Records are views, so this
+  // moves no text; the strings stay in the caller's arena / buffer.
+  std::vector<UpdateExt> all = std::move(local_unmerged);
   all.insert(all.end(), recv_unmerged.begin(), recv_unmerged.end());
 
   // Step 2: Merge chained updates from same user, then resolve conflicts via LWW
-  // First, merge chained updates: if update B's old_text == update A's new_text, merge them
+  // First, merge chained updates: if update B's old_text == update A's new_text, merge them.
+  // Open chain heads are indexed by (line, replica, cs, new_text), so each update is
+  // matched against its predecessor with one hash lookup instead of a rescan.
+  // Chains are folded at the end (tail[i] = last update merged into i), so the
+  // views used as index keys never change during the scan.
+  std::vector<char> alive(all.size(), 1);
+  std::vector<size_t> tail(all.size());
+  std::unordered_map<ChainKey, std::vector<size_t>, ChainKeyHash> heads;
+  heads.reserve(all.size());
+  bool has_structural = false;
+  for (size_t j = 0; j < all.size(); ++j) {
+    tail[j] = j;
+    if (is_structural(all[j].op)) {
+      has_structural = true;
+      continue;
+    }
+    auto it = heads.find(ChainKey{all[j].line, all[j].cs, all[j].rid, all[j].old_text});
+    if (it != heads.end()) {
+      // Merge j into the earliest matching head i: keep i's old_text, use j's new_text
+      size_t i = it->second.front();
+      it->second.erase(it->second.begin());
+      if (it->second.empty()) heads.erase(it);
+      tail[i] = j;
+      alive[j] = 0; // j is folded into i
+      heads[ChainKey{all[i].line, all[i].cs, all[i].rid, all[j].new_text}].push_back(i);
+    } else {
+      heads[ChainKey{all[j].line, all[j].cs, all[j].rid, all[j].new_text}].push_back(j);
+    }
+  }
+  heads.clear();
   for (size_t i = 0; i < all.size(); ++i) {
-    for (size_t j = i + 1; j < all.size(); ++j) {
-      // Check if j is a continuation of i (same line, same user, j's old == i's new)
-      if (all[i].line == all[j].line && 
-          all[i].uid == all[j].uid &&
-          all[i].new_text == all[j].old_text &&
-          all[i].cs == all[j].cs) {
-        // Merge j into i: keep i's old_text, use j's new_text
-        all[i].new_text = all[j].new_text;
-        all[i].ts = all[j].ts; // Use later timestamp
-        // Mark j as merged (will be skipped)
-        all[j].old_text = "###MERGED###";
-      }
+    if (!alive[i] || tail[i] == i) continue;
+    all[i].new_text = all[tail[i]].new_text;
+    all[i].ts = all[tail[i]].ts; // Use later timestamp
+  }
+
+  // With line inserts/deletes in the batch, authors number lines in
+  // different views (see LineLayout). Walk the batch in timestamp order,
+  // which keeps each author's own ops in the order they were made, and move
+  // every intra-line update onto the entry id of the line it targets. The
+  // LWW pass below then compares updates of the same line, whoever's view
+  // they were written in.
+  LineLayout layout;
+  if (has_structural) {
+    layout.base = static_cast<uint32_t>(lines.size());
+    layout.runs.push_back(LineRun{0, layout.base, true, ~uint64_t(0)});
+    std::vector<size_t> by_ts;
+    for (size_t i = 0; i < all.size(); ++i) {
+      if (alive[i]) by_ts.push_back(i);
+    }
+    std::stable_sort(by_ts.begin(), by_ts.end(), [&](size_t a, size_t b) { return all[a].ts < all[b].ts; });
+    std::vector<uint16_t> authors; // bit index per author (past 64 authors, views are shared)
+    for (size_t i : by_ts) {
+      UpdateExt &u = all[i];
+      size_t a = std::find(authors.begin(), authors.end(), u.rid) - authors.begin();
+      if (a == authors.size()) authors.push_back(u.rid);
+      uint64_t bit = uint64_t(1) << std::min<size_t>(a, 63);
+      if (u.op == OpType::LineInsert) layout_insert(layout, bit, u.line, u.new_text);
+      else if (u.op == OpType::LineDelete) layout_delete(layout, bit, u.line);
+      else u.line = layout_entry(layout, bit, u.line);
     }
   }
-  
-  // Now resolve conflicts via LWW using overlaps()
-  std::vector<char> alive(all.size(), 1);
-  int conflicts_resolved = 0;
+
+  // Now resolve conflicts via LWW using the same overlap rules as overlaps().
+  // Bucket by line and visit each line's updates newest-first: an update
+  // survives iff it does not overlap an already accepted (newer) one. Accepted
+  // ranges on a line never overlap each other, so a neighbour lookup in an
+  // ordered index is enough to detect a conflict.
+  std::vector<size_t> order;
+  order.reserve(all.size());
+  size_t structural = 0;
   for (size_t i = 0; i < all.size(); ++i) {
     if (!alive[i]) continue;
-    if (all[i].old_text == "###MERGED###") { alive[i] = 0; continue; } // Skip merged
-    for (size_t j = i + 1; j < all.size(); ++j) {
-      if (!alive[j]) continue;
-      if (all[j].old_text == "###MERGED###") { alive[j] = 0; continue; } // Skip merged
-      if (overlaps(all[i], all[j])) {
-        conflicts_resolved++;
-        if (newer_wins(all[i], all[j])) {
-          alive[j] = 0;
-        } else {
-          alive[i] = 0;
-          break;
-        }
-      }
+    if (!is_structural(all[i].op)) order.push_back(i);
+    else structural++;
+  }
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    if (all[a].line != all[b].line) return all[a].line < all[b].line;
+    return newer_wins(all[a], all[b]);
+  });
+  int conflicts_resolved = 0;
+  std::map<int, int> ranges;   // accepted non-empty ranges: start -> end (exclusive)
+  std::set<int> insert_points; // accepted pure inserts
+  for (size_t k = 0; k < order.size(); ++k) {
+    const UpdateExt &u = all[order[k]];
+    if (k == 0 || all[order[k - 1]].line != u.line) {
+      ranges.clear();
+      insert_points.clear();
     }
+    if (conflicts_with_accepted(u, ranges, insert_points)) {
+      alive[order[k]] = 0;
+      conflicts_resolved++;
+      continue;
+    }
+    int u_end = u.cs + static_cast<int>(u.old_text.size());
+    if (u.old_text.empty()) insert_points.insert(u.cs);
+    else ranges.emplace(u.cs, u_end);
   }
-  // Step 3: Collect survivors
-  std::vector<UpdateExt> winners;
-  winners.reserve(all.size());
+  (void)conflicts_resolved;
+
+  // Step 3: Collect surviving intra-line updates (compacted in place); line
+  // inserts/deletes are already in the layout
+  size_t kept = 0;
   for (size_t i = 0; i < all.size(); ++i) {
-    if (alive[i]) winners.push_back(all[i]);
-  }
-
-  // Step 4: Group by line and sort by timestamp (newest first)
-  std::map<uint32_t, std::vector<UpdateExt>> updates_per_line;
-  for (const auto &u : winners) updates_per_line[u.line].push_back(u);
-
-  // Step 5: Apply all survivors per line with offset tracking
-  for (auto &kv : updates_per_line) {
-    uint32_t line_num = kv.first;
-    auto &vec = kv.second;
-    while (lines.size() <= line_num) lines.emplace_back("");
-
-    // Sort by column (ascending) and timestamp (descending) to apply newer updates last
-    std::sort(vec.begin(), vec.end(), [](const UpdateExt &a, const UpdateExt &b) {
-      if (a.cs != b.cs) return a.cs < b.cs;
-      return a.ts > b.ts; // Newer timestamps come first for same position
-    });
-
-    // Apply updates in order, tracking offsets
-    std::string cur = lines[line_num];
-    int offset = 0;
-    
-    for (const auto &u : vec) {
-      // Adjust position by accumulated offset
-      int adjusted_cs = u.cs + offset;
-      int adjusted_ce = u.ce + offset;
-      
-      // Ensure adjusted positions are within bounds
-      adjusted_cs = std::max(0, adjusted_cs);
-      adjusted_ce = std::min(adjusted_ce, static_cast<int>(cur.size()) - 1);
-      
-      // Apply the update
-      std::string new_line = cur.substr(0, adjusted_cs) + u.new_text;
-      if (adjusted_ce >= 0 && static_cast<size_t>(adjusted_ce + 1) < cur.size()) {
-        new_line += cur.substr(adjusted_ce + 1);
-      }
-      
-      // Update offset for subsequent operations
-      offset += (static_cast<int>(u.new_text.size()) - (adjusted_ce - adjusted_cs + 1));
-      cur = std::move(new_line);
-    }
-    
-    lines[line_num] = std::move(cur);
+    if (alive[i] && !is_structural(all[i].op)) all[kept++] = all[i];
   }
+  all.resize(kept);
+  std::vector<UpdateExt> &winners = all;
+
+  // Step 4/5: Apply survivors
+  if (!has_structural) apply_line_updates(lines, winners);
+  else layout_apply(lines, layout, winners);
 
   local_unmerged.clear();
   recv_unmerged.clear();
-  return !winners.empty();
+  return !winners.empty() || structural > 0;
 }
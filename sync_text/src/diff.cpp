@@ -0,0 +1,174 @@
+#include "../include/diff.h"
+
+#include <algorithm>
+
+// Linear-space Myers diff over hash sequences a and b. Marks deleted lines of
+// a and inserted lines of b; everything unmarked is matched in order.
+struct MyersDiff {
+  const uint64_t *a;
+  const uint64_t *b;
+  std::vector<char> deleted;
+  std::vector<char> inserted;
+  std::vector<long> vf; // forward furthest x per diagonal k
+  std::vector<long> vb; // backward furthest y per diagonal c
+
+  struct Point { long x, y; };
+
+  // Find the middle snake of the box [left,right) x [top,bottom); start and
+  // finish bracket one edit plus the diagonal run next to it.
+  void midpoint(long left, long top, long right, long bottom, Point &start, Point &finish) {
+    long width = right - left;
+    long height = bottom - top;
+    long delta = width - height;
+    long max = (width + height + 1) / 2;
+    long off = max + 1;
+    vf.assign(static_cast<std::size_t>(2 * max + 3), 0);
+    vb.assign(static_cast<std::size_t>(2 * max + 3), 0);
+    vf[off + 1] = left;
+    vb[off + 1] = bottom;
+
+    for (long d = 0; d <= max; ++d) {
+      // Forward pass
+      for (long k = d; k >= -d; k -= 2) {
+        long c = k - delta;
+        long px, x;
+        if (k == -d || (k != d && vf[off + k - 1] < vf[off + k + 1])) {
+          px = x = vf[off + k + 1];
+        } else {
+          px = vf[off + k - 1];
+          x = px + 1;
+        }
+        long y = top + (x - left) - k;
+        long py = (d == 0 || x != px) ? y : y - 1;
+        while (x < right && y < bottom && a[x] == b[y]) {
+          x++;
+          y++;
+        }
+        vf[off + k] = x;
+        if ((delta & 1) && c >= -(d - 1) && c <= d - 1 && y >= vb[off + c]) {
+          start = {px, py};
+          finish = {x, y};
+          return;
+        }
+      }
+      // Backward pass
+      for (long c = d; c >= -d; c -= 2) {
+        long k = c + delta;
+        long py, y;
+        if (c == -d || (c != d && vb[off + c - 1] > vb[off + c + 1])) {
+          py = y = vb[off + c + 1];
+        } else {
+          py = vb[off + c - 1];
+          y = py - 1;
+        }
+        long x = left + (y - top) + k;
+        long px = (d == 0 || y != py) ? x : x + 1;
+        while (x > left && y > top && a[x - 1] == b[y - 1]) {
+          x--;
+          y--;
+        }
+        vb[off + c] = y;
+        if (!(delta & 1) && k >= -d && k <= d && x <= vf[off + k]) {
+          start = {x, y};
+          finish = {px, py};
+          return;
+        }
+      }
+    }
+    // Unreachable for a non-empty box; fall back to replacing it wholesale
+    start = {left, top};
+    finish = {left, top};
+  }
+
+  // Apply the single edit plus diagonals between two points of the path
+  void walk_snake(Point p, Point q) {
+    long x = p.x, y = p.y;
+    while (x < q.x && y < q.y && a[x] == b[y]) {
+      x++;
+      y++;
+    }
+    if (q.x - x > q.y - y) deleted[static_cast<std::size_t>(x++)] = 1;
+    else if (q.x - x < q.y - y) inserted[static_cast<std::size_t>(y++)] = 1;
+  }
+
+  void compare(long left, long top, long right, long bottom) {
+    while (left < right && top < bottom && a[left] == b[top]) {
+      left++;
+      top++;
+    }
+    while (left < right && top < bottom && a[right - 1] == b[bottom - 1]) {
+      right--;
+      bottom--;
+    }
+    if (left == right) {
+      for (long y = top; y < bottom; ++y) inserted[static_cast<std::size_t>(y)] = 1;
+      return;
+    }
+    if (top == bottom) {
+      for (long x = left; x < right; ++x) deleted[static_cast<std::size_t>(x)] = 1;
+      return;
+    }
+    Point start, finish;
+    midpoint(left, top, right, bottom, start, finish);
+    if (start.x == left && start.y == top && finish.x == left && finish.y == top) {
+      for (long x = left; x < right; ++x) deleted[static_cast<std::size_t>(x)] = 1;
+      for (long y = top; y < bottom; ++y) inserted[static_cast<std::size_t>(y)] = 1;
+      return;
+    }
+    compare(left, top, start.x, start.y);
+    walk_snake(start, finish);
+    compare(finish.x, finish.y, right, bottom);
+  }
+};
+
+std::vector<DiffHunk> diff_lines(const std::vector<uint64_t> &old_hashes,
+                                 const std::vector<uint64_t> &new_hashes) {
+  MyersDiff md;
+  md.a = old_hashes.data();
+  md.b = new_hashes.data();
+  md.deleted.assign(old_hashes.size(), 0);
+  md.inserted.assign(new_hashes.size(), 0);
+  md.compare(0, 0, static_cast<long>(old_hashes.size()), static_cast<long>(new_hashes.size()));
+
+  std::vector<DiffHunk> hunks;
+  std::size_t i = 0, j = 0;
+  const std::size_t n = old_hashes.size(), m = new_hashes.size();
+  while (i < n || j < m) {
+    if (i < n && j < m && !md.deleted[i] && !md.inserted[j]) {
+      i++;
+      j++;
+      continue;
+    }
+    DiffHunk h{i, 0, j, 0};
+    while (i < n && md.deleted[i]) i++;
+    while (j < m && md.inserted[j]) j++;
+    h.old_len = i - h.old_pos;
+    h.new_len = j - h.new_pos;
+    if (h.old_len == 0 && h.new_len == 0) break; // inconsistent marks; should not happen
+    hunks.push_back(h);
+  }
+  return hunks;
+}
+
+bool diff_line_span(std::string_view old_line, std::string_view new_line,
+                    int &cs, std::string &old_seg, std::string &new_seg) {
+  if (old_line == new_line) return false;
+  // Compute minimal differing span: cs (first diff), tail (common suffix)
+  int old_len = static_cast<int>(old_line.size());
+  int new_len = static_cast<int>(new_line.size());
+  cs = 0;
+  int max_common_left = std::min(old_len, new_len);
+  while (cs < max_common_left && old_line[cs] == new_line[cs]) cs++;
+
+  int tail = 0;
+  while (tail < (old_len - cs) && tail < (new_len - cs) &&
+         old_line[old_len - 1 - tail] == new_line[new_len - 1 - tail]) {
+    tail++;
+  }
+
+  int old_mid_len = old_len - cs - tail;
+  int new_mid_len = new_len - cs - tail;
+  old_seg.assign(old_line.substr(cs, std::max(old_mid_len, 0)));
+  new_seg.assign(new_line.substr(cs, std::max(new_mid_len, 0)));
+  return old_seg != new_seg;
+}
@@ -0,0 +1,226 @@
+#include "../include/docio.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+static FileStamp stamp_of(const struct stat &st) {
+  FileStamp s;
+  s.mtime_ns = static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000ull + static_cast<uint64_t>(st.st_mtim.tv_nsec);
+  s.size = static_cast<uint64_t>(st.st_size);
+  s.ino = static_cast<uint64_t>(st.st_ino);
+  return s;
+}
+
+static void split_lines(MappedDoc &d) {
+  d.lines.clear();
+  const char *p = d.data;
+  const char *end = d.data + d.size;
+  while (p < end) {
+    const char *nl = static_cast<const char *>(std::memchr(p, '\n', static_cast<std::size_t>(end - p)));
+    if (!nl) {
+      d.lines.emplace_back(p, static_cast<std::size_t>(end - p));
+      break;
+    }
+    d.lines.emplace_back(p, static_cast<std::size_t>(nl - p));
+    p = nl + 1;
+  }
+  // Normalize: drop trailing empty lines to avoid phantom blank-line diffs
+  while (!d.lines.empty() && d.lines.back().empty()) d.lines.pop_back();
+}
+
+// Read the whole file into d.copy; false on a read error
+static bool read_copy(int fd, std::size_t size, MappedDoc &d) {
+  d.copy.resize(size);
+  std::size_t got = 0;
+  while (got < size) {
+    ssize_t r = read(fd, d.copy.data() + got, size - got);
+    if (r < 0 && errno == EINTR) continue;
+    if (r < 0) return false;
+    if (r == 0) break; // shrank since fstat
+    got += static_cast<std::size_t>(r);
+  }
+  d.copy.resize(got);
+  d.data = d.copy.data();
+  d.size = got;
+  return true;
+}
+
+int doc_map(const char *path, MappedDoc &d) {
+  doc_unmap(d);
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return errno == ENOENT ? 0 : -1;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return -1;
+  }
+  d.stamp = stamp_of(st);
+  std::size_t size = static_cast<std::size_t>(st.st_size);
+  // A broken lease is signalled with SIGIO, whose default action would end
+  // the process; the lease is released at doc_unmap() anyway
+  static const bool sigio_ignored = std::signal(SIGIO, SIG_IGN) != SIG_ERR;
+  (void)sigio_ignored;
+  if (size >= DOC_MAP_MIN && fcntl(fd, F_SETLEASE, F_RDLCK) == 0) {
+    void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      fcntl(fd, F_SETLEASE, F_UNLCK);
+      close(fd);
+      return -2;
+    }
+    madvise(p, size, MADV_SEQUENTIAL);
+    d.data = static_cast<const char *>(p);
+    d.size = size;
+    d.lease_fd = fd; // holds the lease until doc_unmap()
+  } else {
+    bool ok = read_copy(fd, size, d);
+    int err = errno;
+    close(fd);
+    if (!ok) {
+      doc_unmap(d);
+      errno = err;
+      return -3;
+    }
+  }
+  split_lines(d);
+  return 0;
+}
+
+void doc_unmap(MappedDoc &d) {
+  if (d.lease_fd >= 0) {
+    munmap(const_cast<char *>(d.data), d.size);
+    fcntl(d.lease_fd, F_SETLEASE, F_UNLCK);
+    close(d.lease_fd);
+    d.lease_fd = -1;
+  }
+  d.data = nullptr;
+  d.size = 0;
+  d.copy.clear();
+  d.lines.clear();
+}
+
+void doc_layout(const MappedDoc &d, DocLayout &layout) {
+  layout.line_off.clear();
+  layout.line_off.reserve(d.lines.size());
+  for (auto v : d.lines) layout.line_off.push_back(static_cast<uint64_t>(v.data() - d.data));
+  layout.stamp = d.stamp;
+}
+
+bool doc_stamp(const char *path, FileStamp &s) {
+  struct stat st;
+  if (stat(path, &st) != 0) return false;
+  s = stamp_of(st);
+  return true;
+}
+
+static bool write_all(int fd, const char *p, std::size_t n) {
+  while (n > 0) {
+    ssize_t w = write(fd, p, n);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    p += w;
+    n -= static_cast<std::size_t>(w);
+  }
+  return true;
+}
+
+static bool pwrite_all(int fd, const char *p, std::size_t n, off_t off) {
+  while (n > 0) {
+    ssize_t w = pwrite(fd, p, n, off);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    p += w;
+    off += w;
+    n -= static_cast<std::size_t>(w);
+  }
+  return true;
+}
+
+// Overwrite changed lines of equal length. Returns 1 on success, 0 if the file
+// does not qualify or a write fails (caller rewrites the whole file).
+static int patch_in_place(const char *path, const Document &doc, const std::vector<uint64_t> &hashes,
+                          const Document &disk, const std::vector<uint64_t> &disk_hashes, DocLayout &layout) {
+  if (hashes.size() != disk_hashes.size() || layout.line_off.size() != disk_hashes.size()) return 0;
+  std::vector<std::size_t> changed;
+  for (std::size_t i = 0; i < hashes.size(); ++i) {
+    if (hashes[i] == disk_hashes[i]) continue;
+    if (changed.size() == DOC_PATCH_MAX_LINES || doc[i].size() != disk[i].size()) return 0;
+    changed.push_back(i);
+  }
+
+  int fd = open(path, O_WRONLY | O_CLOEXEC);
+  if (fd < 0) return 0;
+  struct stat st;
+  // Only trust the offsets if the file is still the version they came from
+  if (fstat(fd, &st) != 0 || stamp_of(st) != layout.stamp) {
+    close(fd);
+    return 0;
+  }
+  for (std::size_t i : changed) {
+    const std::string &line = doc[i];
+    if (!pwrite_all(fd, line.data(), line.size(), static_cast<off_t>(layout.line_off[i]))) {
+      close(fd);
+      return 0; // the full rewrite replaces a half-patched file
+    }
+  }
+  if (fstat(fd, &st) == 0) layout.stamp = stamp_of(st);
+  close(fd);
+  return 1;
+}
+
+int doc_replace_file(const char *path, const char *data, std::size_t n, bool sync, FileStamp *stamp) {
+  std::string tmp = std::string(path) + ".tmp." + std::to_string(getpid());
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) return -2;
+  struct stat st;
+  if (stat(path, &st) == 0) fchmod(fd, st.st_mode & 07777); // keep the existing file's permissions
+  if (!write_all(fd, data, n) || (sync && fdatasync(fd) != 0) || fstat(fd, &st) != 0) {
+    close(fd);
+    unlink(tmp.c_str());
+    return -3;
+  }
+  close(fd);
+  if (rename(tmp.c_str(), path) != 0) {
+    unlink(tmp.c_str());
+    return -4;
+  }
+  if (stamp) *stamp = stamp_of(st); // rename keeps inode, size and mtime
+  return 0;
+}
+
+int doc_write(const char *path, const Document &doc, const std::vector<uint64_t> &hashes,
+              const Document &disk, const std::vector<uint64_t> &disk_hashes, DocLayout &layout) {
+  int r = patch_in_place(path, doc, hashes, disk, disk_hashes, layout);
+  if (r != 0) return 1;
+
+  // Serialise once, recording the new line offsets on the way
+  std::string buf;
+  std::size_t total = 0;
+  doc.for_each([&](std::size_t, const std::string &line) { total += line.size() + 1; });
+  buf.reserve(total);
+  std::vector<uint64_t> offsets;
+  offsets.reserve(doc.size());
+  doc.for_each([&](std::size_t, const std::string &line) {
+    offsets.push_back(buf.size());
+    buf += line;
+    buf.push_back('\n');
+  });
+
+  FileStamp stamp;
+  r = doc_replace_file(path, buf.data(), buf.size(), false, &stamp);
+  if (r != 0) return r;
+  layout.line_off = std::move(offsets);
+  layout.stamp = stamp;
+  return 0;
+}
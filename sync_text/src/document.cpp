@@ -0,0 +1,117 @@
+#include "../include/document.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+Document::Document(std::vector<std::string> lines) {
+  root = build(lines, 0, lines.size());
+}
+
+std::size_t Document::size() const { return count_of(root); }
+
+const std::string &Document::operator[](std::size_t i) const {
+  const Node *n = root.get();
+  while (n) {
+    std::size_t ls = count_of(n->left);
+    if (i < ls) {
+      n = n->left.get();
+    } else if (i == ls) {
+      return *n->line;
+    } else {
+      i -= ls + 1;
+      n = n->right.get();
+    }
+  }
+  throw std::out_of_range("Document line index");
+}
+
+void Document::set(std::size_t i, std::string line) {
+  if (i >= size()) throw std::out_of_range("Document line index");
+  root = set_at(root, i, std::make_shared<const std::string>(std::move(line)));
+}
+
+void Document::insert(std::size_t i, std::string line) {
+  if (i > size()) throw std::out_of_range("Document line index");
+  root = insert_at(root, i, std::make_shared<const std::string>(std::move(line)));
+}
+
+void Document::erase(std::size_t i) {
+  if (i >= size()) throw std::out_of_range("Document line index");
+  root = erase_at(root, i);
+}
+
+std::vector<std::string> Document::to_vector() const {
+  std::vector<std::string> out;
+  out.reserve(size());
+  for_each([&](std::size_t, const std::string &line) { out.push_back(line); });
+  return out;
+}
+
+Document::NodePtr Document::make(NodePtr l, LinePtr line, NodePtr r) {
+  std::size_t count = count_of(l) + count_of(r) + 1;
+  int height = std::max(height_of(l), height_of(r)) + 1;
+  return std::make_shared<const Node>(Node{std::move(l), std::move(r), std::move(line), count, height});
+}
+
+// Join l and r around line, restoring the AVL invariant with at most two
+// rotations. Only freshly created nodes are modified; inputs are shared.
+Document::NodePtr Document::balance(NodePtr l, LinePtr line, NodePtr r) {
+  int hl = height_of(l);
+  int hr = height_of(r);
+  if (hl > hr + 1) {
+    if (height_of(l->left) >= height_of(l->right)) {
+      return make(l->left, l->line, make(l->right, std::move(line), std::move(r)));
+    }
+    const NodePtr &lr = l->right;
+    return make(make(l->left, l->line, lr->left), lr->line, make(lr->right, std::move(line), std::move(r)));
+  }
+  if (hr > hl + 1) {
+    if (height_of(r->right) >= height_of(r->left)) {
+      return make(make(std::move(l), std::move(line), r->left), r->line, r->right);
+    }
+    const NodePtr &rl = r->left;
+    return make(make(std::move(l), std::move(line), rl->left), rl->line, make(rl->right, r->line, r->right));
+  }
+  return make(std::move(l), std::move(line), std::move(r));
+}
+
+Document::NodePtr Document::build(std::vector<std::string> &lines, std::size_t lo, std::size_t hi) {
+  if (lo >= hi) return nullptr;
+  std::size_t mid = lo + (hi - lo) / 2;
+  NodePtr l = build(lines, lo, mid);
+  NodePtr r = build(lines, mid + 1, hi);
+  return make(std::move(l), std::make_shared<const std::string>(std::move(lines[mid])), std::move(r));
+}
+
+Document::NodePtr Document::insert_at(const NodePtr &n, std::size_t i, LinePtr line) {
+  if (!n) return make(nullptr, std::move(line), nullptr);
+  std::size_t ls = count_of(n->left);
+  if (i <= ls) return balance(insert_at(n->left, i, std::move(line)), n->line, n->right);
+  return balance(n->left, n->line, insert_at(n->right, i - ls - 1, std::move(line)));
+}
+
+Document::NodePtr Document::erase_min(const NodePtr &n, LinePtr &out) {
+  if (!n->left) {
+    out = n->line;
+    return n->right;
+  }
+  return balance(erase_min(n->left, out), n->line, n->right);
+}
+
+Document::NodePtr Document::erase_at(const NodePtr &n, std::size_t i) {
+  std::size_t ls = count_of(n->left);
+  if (i < ls) return balance(erase_at(n->left, i), n->line, n->right);
+  if (i > ls) return balance(n->left, n->line, erase_at(n->right, i - ls - 1));
+  if (!n->left) return n->right;
+  if (!n->right) return n->left;
+  LinePtr succ;
+  NodePtr r = erase_min(n->right, succ);
+  return balance(n->left, std::move(succ), std::move(r));
+}
+
+Document::NodePtr Document::set_at(const NodePtr &n, std::size_t i, LinePtr line) {
+  std::size_t ls = count_of(n->left);
+  if (i < ls) return make(set_at(n->left, i, std::move(line)), n->line, n->right);
+  if (i > ls) return make(n->left, n->line, set_at(n->right, i - ls - 1, std::move(line)));
+  return make(n->left, std::move(line), n->right);
+}
@@ -1,6 +1,21 @@
 #include "../include/registry.h"
 #include "../include/message.h"
+#include "../include/oplog.h"
+#include "../include/wire.h"
 #include "../include/crdt.h"
+#include "../include/diff.h"
+#include "../include/docio.h"
+#include "../include/document.h"
+#include "../include/hash.h"
+#include "../include/hlc.h"
+#include "../include/join.h"
+#include "../include/peers.h"
+#include "../include/replica.h"
+#include "../include/rga.h"
+#include "../include/ring_buffer.h"
+#include "../include/shm_ring.h"
+#include "../include/vv.h"
+#include "../include/watcher.h"
 
 #include <algorithm>
 #include <atomic>
@@ -10,13 +25,19 @@
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
+#include <deque>
 #include <errno.h>
 #include <fcntl.h>
 #include <fstream>
 #include <iostream>
+#include <iterator>
 #include <mqueue.h>
+#include <poll.h>
+#include <set>
 #include <sstream>
 #include <string>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -29,49 +50,66 @@ static RegistrySegment *g_registry_seg = nullptr;
 static std::string g_user_id;
 static std::string g_queue_name; // e.g., /queue_user_1
 static mqd_t g_mq = (mqd_t)-1;
-static bool g_running = true;
+static ShmRing *g_ring = nullptr; // own receive ring when SYNCTEXT_TRANSPORT=shm
+static std::atomic<bool> g_running{true};
 static std::atomic<uint64_t> g_recv_total{0};
 static char g_last_sender[USER_ID_MAX] = {0};
 static std::atomic<uint64_t> g_sent_total{0};
+static uint64_t g_next_msg_id = 1; // fragment reassembly id for outgoing updates
 static char g_last_target[USER_ID_MAX] = {0};
+static PeerTable g_peers;   // cached descriptors for other users' queues
+static DocWatcher g_watcher; // wakes the main loop on document saves and received updates
+static int g_listener_stop_fd = -1; // eventfd: wakes the listener for shutdown
+static int g_listener_epfd = -1;    // queue listener's epoll set (mqueue transport)
+static Hlc g_clock;          // stamps local ops; advanced by every received op
+static uint64_t g_epoch = 0; // this run's id in (epoch, seq) op numbering (see vv.h)
+static uint32_t g_slot_gen = 0; // our registry slot's generation, sent with every op
+static uint64_t g_next_seq = 1;
 
-// Lock-free SPSC ring buffer for received updates (listener -> main)
-template <typename T, size_t CAP>
-struct RingBuffer {
-  std::atomic<size_t> head{0};
-  std::atomic<size_t> tail{0};
-  T data[CAP];
-  bool push(const T &v) {
-    size_t h = head.load(std::memory_order_relaxed);
-    size_t n = (h + 1) % CAP;
-    if (n == tail.load(std::memory_order_acquire)) return false; // full
-    data[h] = v;
-    head.store(n, std::memory_order_release);
-    return true;
-  }
-  bool pop(T &out) {
-    size_t t = tail.load(std::memory_order_relaxed);
-    if (t == head.load(std::memory_order_acquire)) return false; // empty
-    out = data[t];
-    tail.store((t + 1) % CAP, std::memory_order_release);
-    return true;
-  }
+// One received queue / ring message. The listener receives straight into a
+// reserved slot and the main loop decodes it in place (wire.h UpdateView),
+// so a frame is copied once, by the kernel or the shm ring.
+struct RecvFrame {
+  uint32_t len;
+  char data[WIRE_MSG_MAX];
 };
+static RingBuffer<RecvFrame, 64> g_recv_frames; // listener -> main, updates and control frames
 
-static RingBuffer<UpdateMessage, 128> g_recv_buf;
+// Receive backpressure. With no free slot the listener stops reading its
+// queue / ring until the main loop frees one (g_recv_space_fd). Unread frames
+// then fill the transport and senders retry (vv.h), so a burst delays
+// updates instead of losing them.
+static int g_recv_space_fd = -1;                     // eventfd: main loop released slots
+static std::atomic<bool> g_listener_blocked{false};  // listener waits on g_recv_space_fd
+static std::atomic<uint64_t> g_recv_stalls{0};       // times the listener had to wait
+static std::atomic<uint64_t> g_recv_dropped{0};      // malformed frames discarded
+static std::atomic<uint64_t> g_recv_ahead{0};        // updates held back, stamped too far ahead
+static std::atomic<uint64_t> g_recv_stale{0};        // updates from a slot's previous owner
+static std::atomic<uint64_t> g_recv_high_water{0};   // most frames queued at once
 
 static void cleanup_and_exit(int code) {
   g_running = false;
+  if (g_listener_stop_fd >= 0) {
+    uint64_t one = 1;
+    ssize_t r = write(g_listener_stop_fd, &one, sizeof(one));
+    (void)r;
+  }
   if (!g_user_id.empty() && g_registry_seg) {
     registry_unregister(g_registry_seg, g_user_id.c_str());
   }
-  if (!g_queue_name.empty()) {
+  if (g_ring) {
+    // The listener may still be inside the ring: keep it mapped (it goes
+    // away with the process) and only remove the name
+    shm_unlink(g_queue_name.c_str());
+  } else if (!g_queue_name.empty()) {
     if (g_mq != (mqd_t)-1) {
       mq_close(g_mq);
       g_mq = (mqd_t)-1;
     }
     mq_unlink(g_queue_name.c_str());
   }
+  peers_close(g_peers);
+  watcher_close(g_watcher);
   if (g_registry_seg) {
     munmap(g_registry_seg, sizeof(RegistrySegment));
     g_registry_seg = nullptr;
@@ -105,16 +143,19 @@ static void ensure_initial_doc(const std::string &path) {
   ofs << "int z = 30;\n";
 }
 
-static std::vector<std::string> read_lines(const std::string &path) {
-  std::ifstream ifs(path);
-  std::vector<std::string> lines;
-  std::string line;
-  while (std::getline(ifs, line)) {
-    lines.push_back(line);
-  }
-  // Normalize: drop trailing empty lines to avoid phantom blank-line diffs
-  while (!lines.empty() && lines.back().empty()) lines.pop_back();
-  return lines;
+// Fingerprint every line into hashes; returns the whole-document hash
+static uint64_t hash_lines(const std::vector<std::string_view> &lines, std::vector<uint64_t> &hashes) {
+  hashes.clear();
+  hashes.reserve(lines.size());
+  for (const auto &l : lines) hashes.push_back(hash_line(l));
+  return hash_bytes(hashes.data(), hashes.size() * sizeof(uint64_t));
+}
+
+static uint64_t hash_lines(const Document &lines, std::vector<uint64_t> &hashes) {
+  hashes.clear();
+  hashes.reserve(lines.size());
+  lines.for_each([&](size_t, const std::string &l) { hashes.push_back(hash_line(l)); });
+  return hash_bytes(hashes.data(), hashes.size() * sizeof(uint64_t));
 }
 
 struct Change {
@@ -125,44 +166,47 @@ struct Change {
   std::string new_text; // segment inserted
   std::string timestamp;
   std::string user_id;
-  std::string type;     // insert/delete/replace
+  std::string type;     // insert/delete/replace/insert_line/delete_line
 };
 
-// Helper to verify if a user's queue actually exists
-static bool queue_exists(const char *queue_name) {
-  if (queue_name[0] == '\0') return false;
-  mqd_t test = mq_open(queue_name, O_WRONLY | O_NONBLOCK);
-  if (test == (mqd_t)-1) return false;
-  mq_close(test);
-  return true;
-}
-
-static void render_display(const std::string &doc_name, const std::vector<std::string> &lines, const std::vector<UserEntry> &active_users, const Change *last_change) {
+static void render_display(const std::string &doc_name, const Document &lines, const Change *last_change) {
   // Clear screen
   std::cout << "\033[2J\033[H";
   std::cout << "Document: " << doc_name << "\n";
   std::cout << "Last updated: " << now_time_str() << "\n";
   std::cout << "----------------------------------------\n";
-  for (size_t i = 0; i < lines.size(); ++i) {
-    std::cout << "Line " << i << ": " << lines[i];
+  lines.for_each([&](size_t i, const std::string &line) {
+    std::cout << "Line " << i << ": " << line;
     if (last_change && last_change->line == static_cast<int>(i)) {
       std::cout << " [MODIFIED]";
     }
     std::cout << "\n";
-  }
+  });
   std::cout << "----------------------------------------\n";
   std::cout << "Active users: ";
   bool first = true;
-  // Only show users whose queues actually exist
-  for (const auto &u : active_users) {
-    if (queue_exists(u.queue_name)) {
-      if (!first) std::cout << ", ";
-      std::cout << u.user_id;
-      first = false;
-    }
+  // Only show users whose queues are open in the peer table (plus ourselves)
+  for (size_t i = 0; i < MAX_USERS; ++i) {
+    const char *name = nullptr;
+    if (static_cast<int>(i) == g_peers.self_slot) name = g_user_id.c_str();
+    else if (g_peers.peers[i].live) name = g_peers.peers[i].user_id;
+    if (!name) continue;
+    if (!first) std::cout << ", ";
+    std::cout << name;
+    first = false;
   }
   if (first) std::cout << "(none)";
   std::cout << "\n";
+  uint64_t stalls = g_recv_stalls.load(std::memory_order_relaxed);
+  uint64_t dropped = g_recv_dropped.load(std::memory_order_relaxed);
+  if (stalls > 0 || dropped > 0) {
+    std::cout << "Receive queue: peak " << g_recv_high_water.load(std::memory_order_relaxed) << " frames, "
+              << stalls << " stalls, " << dropped << " malformed frames dropped\n";
+  }
+  uint64_t ahead = g_recv_ahead.load(std::memory_order_relaxed);
+  if (ahead > 0) std::cout << ahead << " updates held back (stamped over a minute ahead of our clock)\n";
+  uint64_t stale = g_recv_stale.load(std::memory_order_relaxed);
+  if (stale > 0) std::cout << stale << " updates from users who left dropped\n";
   if (last_change && last_change->col_start >= 0) {
     std::cout << "Change detected: Line " << last_change->line << ", col "
               << last_change->col_start << "-" << last_change->col_end << ", \""
@@ -184,47 +228,136 @@ static inline uint64_t now_ns() {
   return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
 }
 
+// Called after releasing frame slots: resume a listener waiting for space.
+// The ring's release of the slots is not seq_cst; the fence orders it before
+// the flag load, pairing with the fence in wait_for_space (either the
+// listener sees the free slot or we see its flag).
+static void release_listener() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (!g_listener_blocked.load(std::memory_order_seq_cst)) return;
+  uint64_t one = 1;
+  ssize_t r = write(g_recv_space_fd, &one, sizeof(one));
+  (void)r;
+}
+
+// Author, timestamp and (epoch, seq) of a new local op
+static void stamp_message(UpdateMessage &m) {
+  m.sender = static_cast<uint16_t>(g_peers.self_slot);
+  m.sender_gen = g_slot_gen;
+  m.hlc = hlc_now(g_clock);
+  m.epoch = g_epoch;
+  m.seq = g_next_seq++;
+}
+
 static void to_message(const Change &c, UpdateMessage &m) {
-  std::snprintf(m.sender, USER_ID_MAX, "%s", g_user_id.c_str());
-  m.timestamp_ns = now_ns();
+  stamp_message(m);
   m.line = static_cast<uint32_t>(c.line);
   m.col_start = c.col_start;
   m.col_end = c.col_end;
   if (c.type == "insert") m.op = OpType::Insert;
   else if (c.type == "delete") m.op = OpType::Delete;
+  else if (c.type == "insert_line") m.op = OpType::LineInsert;
+  else if (c.type == "delete_line") m.op = OpType::LineDelete;
   else m.op = OpType::Replace;
-  std::snprintf(m.old_text, TEXT_SEG_MAX, "%s", c.old_text.c_str());
-  std::snprintf(m.new_text, TEXT_SEG_MAX, "%s", c.new_text.c_str());
+  m.old_text = c.old_text;
+  m.new_text = c.new_text;
 }
 
-static std::string make_queue_name(const std::string &uid) {
-  return std::string("/queue_") + uid;
+static std::string make_queue_name(const std::string &uid, bool shm) {
+  return std::string(shm ? SHM_RING_PREFIX : "/queue_") + uid;
+}
+
+// Block until the main loop frees a slot (or shutdown); the main loop is
+// woken first so it drains what is already queued
+static void wait_for_space() {
+  g_recv_stalls.fetch_add(1, std::memory_order_relaxed);
+  while (g_running) {
+    g_listener_blocked.store(true, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst); // flag store before the ring's acquire load
+    if (g_recv_frames.reserve()) break; // freed between the check and the flag
+    watcher_notify(g_watcher);
+    struct pollfd fds[2] = {{g_recv_space_fd, POLLIN, 0}, {g_listener_stop_fd, POLLIN, 0}};
+    if (poll(fds, 2, -1) > 0 && (fds[0].revents & POLLIN)) {
+      uint64_t v;
+      ssize_t r = read(g_recv_space_fd, &v, sizeof(v));
+      (void)r;
+    }
+  }
+  g_listener_blocked.store(false, std::memory_order_relaxed);
+}
+
+// Receive frames directly into reserved slots until recv() reports the
+// transport empty; returns frames received
+template <typename Recv>
+static size_t receive_frames(Recv recv) {
+  size_t got = 0;
+  while (g_running) {
+    RecvFrame *slot = g_recv_frames.reserve();
+    if (!slot) {
+      wait_for_space();
+      continue;
+    }
+    long r = recv(slot->data, sizeof(slot->data));
+    if (r < 0) break;
+    slot->len = static_cast<uint32_t>(r);
+    g_recv_frames.commit();
+    ++got;
+    uint64_t queued = g_recv_frames.size();
+    if (queued > g_recv_high_water.load(std::memory_order_relaxed)) {
+      g_recv_high_water.store(queued, std::memory_order_relaxed);
+    }
+  }
+  if (got > 0) watcher_notify(g_watcher);
+  return got;
+}
+
+// Shared-memory transport: drain the ring, then sleep on its futex word
+// (with a timeout while a slot is claimed but unpublished, see shm_ring.h)
+static void ring_listener_loop() {
+  while (g_running) {
+    uint32_t seen = g_ring->futex_word.load(std::memory_order_seq_cst);
+    size_t got = receive_frames([](char *buf, size_t n) { return shm_ring_pop(g_ring, buf, n); });
+    if (got == 0) shm_ring_wait(g_ring, seen, shm_ring_stalled(g_ring) ? SHM_RING_STALL_MS / 4 : -1);
+  }
 }
 
 static void listener_thread_fn() {
-  // Query queue attributes to size buffer correctly
-  struct mq_attr attr{};
-  if (mq_getattr(g_mq, &attr) != 0) {
-    attr.mq_msgsize = sizeof(UpdateMessage);
+  if (g_ring) {
+    ring_listener_loop();
+    return;
   }
-  std::vector<char> buf(static_cast<size_t>(attr.mq_msgsize));
-  // Non-blocking receive loop
+
   while (g_running) {
-    ssize_t r = mq_receive(g_mq, buf.data(), buf.size(), nullptr);
-    if (r >= 0) {
-      UpdateMessage msg{};
-      std::memcpy(&msg, buf.data(), std::min(sizeof(UpdateMessage), static_cast<size_t>(r)));
-      g_recv_buf.push(msg);
-      std::snprintf(g_last_sender, USER_ID_MAX, "%s", msg.sender);
-      g_recv_total.fetch_add(1, std::memory_order_relaxed);
-    } else {
-      if (errno == EAGAIN) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(50));
-      } else {
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-      }
+    struct epoll_event evs[2];
+    int n = epoll_wait(g_listener_epfd, evs, 2, -1);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      std::perror("epoll_wait (listener)");
+      break;
+    }
+    // Drain everything pending in one wake-up (the queue stays O_NONBLOCK;
+    // it was created with mq_msgsize == WIRE_MSG_MAX, the slot size)
+    receive_frames([](char *buf, size_t n) { return static_cast<long>(mq_receive(g_mq, buf, n, nullptr)); });
+  }
+}
+
+// Epoll set the queue listener blocks on: the queue descriptor (an fd on
+// Linux) and the shutdown eventfd. -1 on failure, with errno set.
+static int listener_epoll_open() {
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd < 0) return -1;
+  for (int fd : {static_cast<int>(g_mq), g_listener_stop_fd}) {
+    struct epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+      int err = errno;
+      close(epfd);
+      errno = err;
+      return -1;
     }
   }
+  return epfd;
 }
 
 int main(int argc, char **argv) {
@@ -233,7 +366,12 @@ int main(int argc, char **argv) {
     return 1;
   }
   g_user_id = argv[1];
-  g_queue_name = make_queue_name(g_user_id);
+  const char *transport = std::getenv("SYNCTEXT_TRANSPORT");
+  bool use_shm = transport && std::strcmp(transport, "shm") == 0;
+  const char *merge_mode = std::getenv("SYNCTEXT_MERGE");
+  const bool use_rga = merge_mode && std::strcmp(merge_mode, "rga") == 0;
+  g_queue_name = make_queue_name(g_user_id, use_shm);
+  peers_init(g_peers, -1); // no descriptors yet; safe for cleanup_and_exit
 
   std::signal(SIGINT, handle_signal);
   std::signal(SIGTERM, handle_signal);
@@ -244,343 +382,984 @@ int main(int argc, char **argv) {
   }
 
   int slot = -1;
-  // Create our message queue before registering so we can store the name
-  // Use attributes within kernel limits (msg_max=10) and msgsize exactly sizeof(UpdateMessage)
-  mq_unlink(g_queue_name.c_str());
-  struct mq_attr attr{};
-  attr.mq_flags = 0; // flags ignored on create
-  attr.mq_maxmsg = 10;
-  attr.mq_msgsize = sizeof(UpdateMessage);
-  attr.mq_curmsgs = 0;
-  g_mq = mq_open(g_queue_name.c_str(), O_CREAT | O_RDONLY | O_NONBLOCK, 0666, &attr);
-  if (g_mq == (mqd_t)-1) {
-    std::perror("mq_open (self)");
-    cleanup_and_exit(2);
+  // Create our receive endpoint before registering so we can store the name
+  if (use_shm) {
+    if (shm_ring_create(g_queue_name.c_str(), g_ring) != 0) {
+      std::perror("shm_ring_create (self)");
+      cleanup_and_exit(2);
+    }
+    std::printf("Shared-memory ring created: %s\n", g_queue_name.c_str());
+  } else {
+    // Use attributes within kernel limits (msg_max=10); messages are packed frames of at most WIRE_MSG_MAX bytes
+    mq_unlink(g_queue_name.c_str());
+    struct mq_attr attr{};
+    attr.mq_flags = 0; // flags ignored on create
+    attr.mq_maxmsg = 10;
+    attr.mq_msgsize = WIRE_MSG_MAX;
+    attr.mq_curmsgs = 0;
+    g_mq = mq_open(g_queue_name.c_str(), O_CREAT | O_RDONLY | O_NONBLOCK, 0666, &attr);
+    if (g_mq == (mqd_t)-1) {
+      std::perror("mq_open (self)");
+      cleanup_and_exit(2);
+    }
+    std::printf("Message queue created: %s\n", g_queue_name.c_str());
   }
-  std::printf("Message queue created: %s\n", g_queue_name.c_str());
 
-  if (registry_register(g_registry_seg, g_user_id.c_str(), g_queue_name.c_str(), slot) != 0) {
+  if (registry_register(g_registry_seg, g_user_id.c_str(), g_queue_name.c_str(), slot, g_slot_gen) != 0) {
     std::fprintf(stderr, "Failed to register user (max %zu)\n", MAX_USERS);
     cleanup_and_exit(3);
   }
   std::printf("Registered as %s\n", g_user_id.c_str());
 
   std::string doc_name = g_user_id + std::string("_doc.txt");
+
+  // Recover the last merged state from snapshot + op log, if any. The
+  // sequence CRDT keeps no log: it recovers by late join, or starts over
+  // from the file when no peer is running.
+  OpLog oplog;
+  Document recovered;
+  StateVector merged_sv; // per-user high-water timestamp folded into merge_baseline
+  int recovered_rc = use_rga ? 0 : oplog_open(oplog, g_user_id, recovered, merged_sv);
+  if (recovered_rc < 0) {
+    std::fprintf(stderr, "Failed to open op log for %s\n", g_user_id.c_str());
+    cleanup_and_exit(4);
+  }
+  if (recovered_rc > 0) {
+    hlc_update(g_clock, oplog.max_ts);
+    struct stat st{};
+    if (stat(doc_name.c_str(), &st) != 0) {
+      // Document was removed: restore it rather than starting from the default
+      std::vector<uint64_t> hashes;
+      hash_lines(recovered, hashes);
+      DocLayout layout;
+      doc_write(doc_name.c_str(), recovered, hashes, Document(), {}, layout);
+    }
+  }
+  g_epoch = hlc_now(g_clock); // after the log's timestamps: newer than any earlier run
   ensure_initial_doc(doc_name);
 
-  // Load initial content and mtime
-  struct stat st{};
-  if (stat(doc_name.c_str(), &st) != 0) {
+  // Load initial content and its file stamp
+  FileStamp last_stamp; // version of the file prev_lines was taken from
+  if (!doc_stamp(doc_name.c_str(), last_stamp)) {
     std::fprintf(stderr, "Cannot stat %s\n", doc_name.c_str());
     cleanup_and_exit(4);
   }
-  time_t last_mtime = st.st_mtime;
-  auto prev_lines = read_lines(doc_name);
+  Document prev_lines;
+  DocLayout disk_layout; // line offsets of the file as last read or written
+  {
+    MappedDoc d;
+    if (doc_map(doc_name.c_str(), d) != 0) {
+      std::fprintf(stderr, "Cannot read %s: %s\n", doc_name.c_str(), std::strerror(errno));
+      cleanup_and_exit(4);
+    }
+    std::vector<std::string> lines(d.lines.begin(), d.lines.end());
+    prev_lines = Document(std::move(lines));
+    doc_layout(d, disk_layout);
+    last_stamp = d.stamp;
+    doc_unmap(d);
+  }
+  if (recovered_rc > 0) {
+    // Diff the file against the recovered merge state on the first pass, so
+    // edits made while the editor was down become local ops
+    prev_lines = recovered;
+    last_stamp = FileStamp{};
+    std::printf("Recovered %zu lines from %s + %s\n", prev_lines.size(), oplog.snap_path.c_str(),
+                oplog.log_path.c_str());
+  } else if (!use_rga && oplog_snapshot(oplog, prev_lines, merged_sv) != 0) {
+    std::fprintf(stderr, "Failed to write %s\n", oplog.snap_path.c_str());
+  }
+  std::vector<uint64_t> prev_hashes; // per-line fingerprints of prev_lines
+  uint64_t prev_file_hash = hash_lines(prev_lines, prev_hashes);
+
+  if (watcher_open(g_watcher, doc_name.c_str()) != 0) {
+    std::fprintf(stderr, "Failed to set up document watcher\n");
+    cleanup_and_exit(4);
+  }
+  if (g_watcher.polling) {
+    std::printf("inotify unavailable, polling %s every %d ms\n", doc_name.c_str(), WATCH_POLL_MS);
+  }
 
   // Initial display
-  UserEntry users[MAX_USERS];
-  std::size_t ucount = 0;
-  registry_list(g_registry_seg, users, ucount);
-  std::vector<UserEntry> active_users(users, users + ucount);
-  render_display(doc_name, prev_lines, active_users, nullptr);
+  peers_init(g_peers, slot);
+  peers_refresh(g_peers, g_registry_seg);
+  render_display(doc_name, prev_lines, nullptr);
 
   // Start listener thread
+  g_listener_stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  g_recv_space_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (g_listener_stop_fd < 0 || g_recv_space_fd < 0) {
+    std::perror("eventfd");
+    cleanup_and_exit(4);
+  }
+  if (!g_ring && (g_listener_epfd = listener_epoll_open()) < 0) {
+    std::perror("epoll (listener)");
+    cleanup_and_exit(4);
+  }
   std::thread listener(listener_thread_fn);
   listener.detach();
 
   // Local op buffer for broadcast
   std::vector<UpdateMessage> local_ops;
   local_ops.reserve(8);
+  size_t local_edits = 0; // changes behind local_ops (a sequence CRDT replace is two ops)
 
   // Part 3: buffers for merging (UpdateExt defined in crdt.h)
   std::vector<UpdateExt> local_unmerged;
   std::vector<UpdateExt> recv_unmerged;
-  std::vector<std::string> merge_baseline = prev_lines; // Baseline for computing deltas
+  MergeArena pending_text; // text of both buffers, released after each merge
+  Document merge_baseline = prev_lines; // Baseline for computing deltas (shares prev_lines' nodes)
+
+  // Sequence CRDT mode (rga.h): edits are applied to seq as they happen,
+  // local ones when the file is diffed and received ones at merge time, and
+  // the merged document is read off seq instead of rebuilt from a baseline
+  SeqDoc seq;
+  std::vector<SeqOp> recv_seq; // text in pending_text
+  if (use_rga) seq.reset(prev_lines);
+
+  // Write a merged document back (atomic rename, or an in-place patch when
+  // only same-length lines changed) and make it the new local state
+  bool write_failed = false; // merge_baseline is not on disk yet
+  bool revert_save = false;  // the file holds a save that was not recorded
+  auto write_merged = [&](Document &merged) {
+    // Trim trailing empty lines prior to write to avoid phantom blanks
+    while (!merged.empty() && merged.back().empty()) merged.pop_back();
+    std::vector<uint64_t> merged_hashes;
+    uint64_t merged_hash = hash_lines(merged, merged_hashes);
+    if (doc_write(doc_name.c_str(), merged, merged_hashes, prev_lines, prev_hashes, disk_layout) < 0) {
+      if (!write_failed) std::fprintf(stderr, "Failed to write %s: %s\n", doc_name.c_str(), std::strerror(errno));
+      // The merge is logged, so it stays the baseline, but the file still
+      // holds prev_lines: keep last_stamp and prev_* describing it so a local
+      // save is diffed against what the user actually edited
+      write_failed = true;
+      merge_baseline = merged;
+      return;
+    }
+    write_failed = false;
+    revert_save = false;
+    // Our own write is not a local change; the stamp comes from the written fd
+    last_stamp = disk_layout.stamp;
+
+    prev_lines = merged;
+    prev_hashes = std::move(merged_hashes);
+    prev_file_hash = merged_hash;
+    merge_baseline = merged; // Reset baseline after merge
+
+    std::cout << "All updates merged successfully\n";
+    render_display(doc_name, prev_lines, nullptr);
+  };
+  // Merge everything pending against the baseline. The batch is logged (and
+  // synced) before the document is written, then compacted into a snapshot
+  // every OPLOG_SNAPSHOT_OPS ops.
+  auto merge_pending = [&]() {
+    if (use_rga) {
+      bool changed = false;
+      for (const auto &op : recv_seq) changed |= seq.apply(op);
+      recv_seq.clear();
+      pending_text.clear();
+      if (changed || write_failed || revert_save) {
+        Document merged = seq.lines(); // O(1) copy; write_merged trims it
+        write_merged(merged);
+      }
+      return;
+    }
+    state_vector_add(merged_sv, local_unmerged);
+    state_vector_add(merged_sv, recv_unmerged);
+    oplog_append(oplog, local_unmerged, recv_unmerged);
+    Document merged = merge_baseline; // O(1) snapshot of the merge baseline (pre-local-changes)
+    bool changed = do_merge_apply(merged, local_unmerged, recv_unmerged, g_user_id);
+    pending_text.clear();
+    if (oplog_sync(oplog) != 0) {
+      std::fprintf(stderr, "Failed to append to %s: %s\n", oplog.log_path.c_str(), std::strerror(errno));
+    }
+    if (changed || write_failed || revert_save) write_merged(merged);
+    if (oplog.ops_since_snapshot >= OPLOG_SNAPSHOT_OPS && oplog_snapshot(oplog, merge_baseline, merged_sv) != 0) {
+      std::fprintf(stderr, "Failed to write %s\n", oplog.snap_path.c_str());
+    }
+  };
+  // Own ops kept for retransmission (see vv.h): seqs (hist_floor, local_seq]
+  std::deque<UpdateMessage> history;
+  uint64_t hist_floor = 0;
+  // State transfers being streamed to joining peers (see serve_join), by
+  // slot, with the generation they were queued for
+  std::deque<std::string> join_out[MAX_USERS];
+  uint32_t join_out_gen[MAX_USERS] = {};
+  // Send what fits of a queued state transfer; true once none is left. It
+  // goes out ahead of anything else for that peer, which receives our ops
+  // after the state they follow.
+  auto flush_join = [&](PeerConn &peer) {
+    size_t idx = static_cast<size_t>(&peer - g_peers.peers);
+    auto &q = join_out[idx];
+    if (q.empty()) return true;
+    if (!peer.active || peer.generation != join_out_gen[idx]) {
+      q.clear(); // the requester left
+      return true;
+    }
+    while (!q.empty()) {
+      if (peer_send(peer, q.front().data(), q.front().size()) != 0) {
+        if (peer.stall_ns == 0) peer.stall_ns = now_ns();
+        return false;
+      }
+      q.pop_front();
+    }
+    peer.stall_ns = 0;
+    peer.retry_ms = 0;
+    std::printf("Sent document state to %s\n", peer.user_id);
+    return true;
+  };
+  auto send_frames = [&](PeerConn &peer, const std::vector<std::string> &frames) {
+    if (!flush_join(peer)) return false;
+    for (const auto &f : frames) {
+      if (peer_send(peer, f.data(), f.size()) != 0) {
+        if (peer.stall_ns == 0) peer.stall_ns = now_ns();
+        return false;
+      }
+    }
+    peer.stall_ns = 0;
+    peer.retry_ms = 0;
+    std::snprintf(g_last_target, USER_ID_MAX, "%s", peer.user_id);
+    return true;
+  };
+  // Refusing frames for VV_STALL_MS with no ack in that time (vv.h)
+  auto peer_stalled = [](const PeerConn &peer, uint64_t now) {
+    return peer.stall_ns != 0 &&
+           now - std::max(peer.stall_ns, peer.acked_ns) >= static_cast<uint64_t>(VV_STALL_MS) * 1000000ull;
+  };
+  // Send a peer the ops after what it has been sent or confirmed, in slices
+  // of VV_RESEND_MAX. Stops at a full queue (the slice is retried later);
+  // returns whether the peer is caught up.
+  auto send_behind = [&](PeerConn &peer) {
+    uint64_t from = std::max({peer.sent_upto, peer.acked, hist_floor});
+    while (from < g_peers.local_seq) {
+      uint64_t upto = std::min<uint64_t>(g_peers.local_seq, from + VV_RESEND_MAX);
+      std::vector<UpdateMessage> ops(history.begin() + static_cast<std::ptrdiff_t>(from - hist_floor),
+                                     history.begin() + static_cast<std::ptrdiff_t>(upto - hist_floor));
+      std::vector<std::string> frames;
+      wire_frame_batch(ops, g_next_msg_id, frames);
+      if (!send_frames(peer, frames)) return false;
+      peer.sent_upto = from = upto;
+      g_sent_total.fetch_add(ops.size(), std::memory_order_relaxed);
+    }
+    return true;
+  };
+  // Drop ops every active peer has confirmed (stalled ones do not count), and
+  // anything beyond VV_HISTORY_MAX
+  auto trim_history = [&]() {
+    uint64_t keep_after = g_peers.local_seq;
+    uint64_t now = now_ns();
+    for (size_t idx = 0; idx < MAX_USERS; ++idx) {
+      const PeerConn &peer = g_peers.peers[idx];
+      if (static_cast<int>(idx) == g_peers.self_slot || !peer.active || peer_stalled(peer, now)) continue;
+      keep_after = std::min(keep_after, peer.acked);
+    }
+    if (g_peers.local_seq > VV_HISTORY_MAX) keep_after = std::max(keep_after, g_peers.local_seq - VV_HISTORY_MAX);
+    for (; hist_floor < keep_after; ++hist_floor) history.pop_front();
+  };
+  // Broadcast all buffered local operations to every active peer but skip.
+  // Operations beyond the fifth are included too; they are packed into batch
+  // frames, so each peer normally costs one mq_send. Peers still missing
+  // earlier ops get those first, in order.
+  auto broadcast_local = [&](PeerConn *skip) {
+    if (local_ops.empty()) return;
+    std::cout << "Broadcasting " << local_ops.size() << " operations...\n";
+    // Pick up users that registered since the top of the loop; these ops are
+    // owed to them
+    peers_refresh(g_peers, g_registry_seg);
+
+    // Encode the batch once; every peer that is up to date receives the same frames
+    std::vector<std::string> frames;
+    wire_frame_batch(local_ops, g_next_msg_id, frames);
+    uint64_t from = g_peers.local_seq;
+    size_t count = local_ops.size();
+    for (auto &m : local_ops) history.push_back(std::move(m));
+    local_ops.clear();
+    local_edits = 0;
+    g_peers.local_seq += count;
+
+    for (size_t idx = 0; idx < MAX_USERS; ++idx) {
+      if (static_cast<int>(idx) == g_peers.self_slot) continue; // skip self
+      PeerConn &peer = g_peers.peers[idx];
+      if (!peer.active) continue;
+      if (&peer == skip) {
+        // Receives these ops inside its state transfer
+        peer.base = peer.sent_upto = peer.acked = g_peers.local_seq;
+        continue;
+      }
+      if (peer.sent_upto != from || count > VV_RESEND_MAX) {
+        send_behind(peer);
+      } else if (send_frames(peer, frames)) {
+        peer.sent_upto = g_peers.local_seq;
+        g_sent_total.fetch_add(count, std::memory_order_relaxed);
+      }
+    }
+    trim_history();
+  };
+
+  // Delta sync (see vv.h): recv_vv is what we hold from each author. Version
+  // vectors go out every VV_SYNC_MS while something is unconfirmed; missing
+  // ranges are asked for with a nack, at most every VV_SYNC_MS / 4 per author.
+  VersionVector recv_vv;
+  bool recv_vv_changed = false;
+  std::map<std::string, uint64_t> nack_ns;
+  uint64_t next_sync_ns = 0;
+  auto send_vv = [&](PeerConn &peer, bool nack) {
+    std::string f;
+    vv_frame(g_user_id.c_str(), g_epoch, g_peers.local_seq, hist_floor, nack, recv_vv, f);
+    peer_send(peer, f.data(), f.size());
+  };
+  auto request_resend = [&](const char *from) {
+    uint64_t now = now_ns();
+    uint64_t &last = nack_ns[from];
+    if (now - last < static_cast<uint64_t>(VV_SYNC_MS / 4) * 1000000ull) return;
+    PeerConn *peer = peers_find(g_peers, from);
+    if (!peer) return;
+    last = now;
+    send_vv(*peer, true);
+  };
+  auto admit_remote = [&](const UpdateView &m, const PeerConn &from) {
+    switch (vv_admit(recv_vv, from.user_id, m.epoch, m.seq)) {
+    case VvAdmit::Accept:
+      recv_vv_changed = true;
+      return true;
+    case VvAdmit::Gap:
+      request_resend(from.user_id);
+      return false;
+    default:
+      return false; // duplicate or from a previous run
+    }
+  };
+  auto on_vv = [&](const VvSummary &s) {
+    auto it = recv_vv.find(s.sender);
+    bool same_epoch = it != recv_vv.end() && it->second.epoch == s.epoch;
+    if (same_epoch && it->second.next <= s.floor) {
+      std::printf("Lost %llu operations from %s (no longer available)\n",
+                  static_cast<unsigned long long>(s.floor + 1 - it->second.next), s.sender);
+      it->second.next = s.floor + 1;
+      recv_vv_changed = true;
+    }
+    if (s.head > 0 && (!same_epoch || it->second.next <= s.head)) request_resend(s.sender);
+
+    // Their view of our ops
+    PeerConn *peer = peers_find(g_peers, s.sender);
+    if (!peer) return;
+    auto mine = s.entries.find(g_user_id);
+    uint64_t got = (mine != s.entries.end() && mine->second.epoch == g_epoch) ? mine->second.next - 1 : 0;
+    got = std::min(std::max(got, peer->base), g_peers.local_seq);
+    if (got > peer->acked) {
+      peer->acked = got;
+      peer->acked_ns = now_ns();
+    }
+    if (s.nack && got < peer->sent_upto) {
+      std::printf("Resending %llu operations to %s\n", static_cast<unsigned long long>(peer->sent_upto - got),
+                  peer->user_id);
+      peer->sent_upto = got;
+      send_behind(*peer);
+    }
+  };
+  auto sync_pending = [&]() {
+    if (recv_vv_changed) return true;
+    uint64_t now = now_ns();
+    for (size_t idx = 0; idx < MAX_USERS; ++idx) {
+      const PeerConn &peer = g_peers.peers[idx];
+      if (static_cast<int>(idx) != g_peers.self_slot && peer.live && peer.acked < g_peers.local_seq &&
+          !peer_stalled(peer, now)) {
+        return true;
+      }
+    }
+    return false;
+  };
+  // Keep feeding peers whose queue filled up (ops or a state transfer),
+  // backing off while it stays full. Returns the ms until the next retry is
+  // due, -1 if none.
+  auto catch_up = [&]() {
+    int next_ms = -1;
+    uint64_t now = now_ns();
+    for (size_t idx = 0; idx < MAX_USERS; ++idx) {
+      PeerConn &peer = g_peers.peers[idx];
+      if (static_cast<int>(idx) == g_peers.self_slot || !peer.live ||
+          (peer.sent_upto >= g_peers.local_seq && join_out[idx].empty())) {
+        continue;
+      }
+      if (peer_stalled(peer, now)) {
+        if (peer.retry_ms != 0) {
+          std::printf("%s stopped reading; not resending until it acks again\n", peer.user_id);
+          peer.retry_ms = 0;
+        }
+        continue;
+      }
+      int wait_ms;
+      if (now < peer.retry_ns) {
+        wait_ms = static_cast<int>((peer.retry_ns - now + 999999) / 1000000ull);
+      } else if (flush_join(peer) && send_behind(peer)) {
+        continue;
+      } else {
+        peer.retry_ms = peer.retry_ms ? std::min<uint32_t>(peer.retry_ms * 2, VV_RETRY_MAX_MS) : VV_RETRY_MS;
+        peer.retry_ns = now + static_cast<uint64_t>(peer.retry_ms) * 1000000ull;
+        wait_ms = static_cast<int>(peer.retry_ms);
+      }
+      if (next_ms < 0 || wait_ms < next_ms) next_ms = wait_ms;
+    }
+    return next_ms;
+  };
+  auto sync_round = [&]() {
+    for (size_t idx = 0; idx < MAX_USERS; ++idx) {
+      if (static_cast<int>(idx) == g_peers.self_slot) continue;
+      PeerConn &peer = g_peers.peers[idx];
+      if (peer.live && (recv_vv_changed || peer.acked < g_peers.local_seq)) send_vv(peer, false);
+    }
+    recv_vv_changed = false;
+    trim_history();
+  };
+
+  // Late join (see join.h). Every user asks one live peer at a time for what
+  // its recovered state (if any) is missing; merging waits until the reply is
+  // installed or every attempt timed out.
+  bool joining = false;
+  int join_attempts = 0;
+  int join_slot = -1;
+  uint64_t join_deadline_ns = 0;
+  StateAssembler join_asm;
+  auto request_state = [&]() -> bool {
+    peers_refresh(g_peers, g_registry_seg);
+    std::string frame;
+    join_frame_request(g_user_id.c_str(), merged_sv, frame);
+    for (size_t k = 0; k < MAX_USERS && join_attempts < JOIN_MAX_ATTEMPTS; ++k) {
+      size_t idx = (static_cast<size_t>(join_slot + 1) + k) % MAX_USERS;
+      if (static_cast<int>(idx) == g_peers.self_slot) continue;
+      PeerConn &peer = g_peers.peers[idx];
+      if (!peer.active || peer_send(peer, frame.data(), frame.size()) != 0) continue;
+      join_slot = static_cast<int>(idx);
+      join_attempts++;
+      join_deadline_ns = now_ns() + static_cast<uint64_t>(JOIN_TIMEOUT_MS) * 1000000ull;
+      join_asm.reset();
+      std::printf("Requesting document state from %s\n", peer.user_id);
+      return true;
+    }
+    return false;
+  };
+
+  // Responder: our unsent local ops go to everyone else first, the newcomer
+  // receives them inside the state instead. A requester whose state vector
+  // covers our baseline only gets the unmerged ops it does not have. The
+  // frames are queued for the peer and sent without blocking, as its queue
+  // takes them (flush_join, catch_up).
+  auto serve_join = [&](const char *from, const StateVector &have) {
+    peers_refresh(g_peers, g_registry_seg);
+    PeerConn *peer = peers_find(g_peers, from);
+    if (!peer) return;
+    broadcast_local(peer);
+    std::vector<std::string> frames;
+    size_t lines_sent;
+    if (use_rga) {
+      std::string payload;
+      seq.encode(payload, recv_seq);
+      join_frame_payload(g_user_id.c_str(), g_next_msg_id++, payload, frames);
+      lines_sent = seq.newlines();
+    } else {
+      // An empty vector is a newcomer: its file is not our baseline
+      bool ops_only = !have.empty() && std::all_of(merged_sv.begin(), merged_sv.end(), [&](const auto &kv) {
+        auto it = have.find(kv.first);
+        return it != have.end() && it->second >= kv.second;
+      });
+      if (ops_only) {
+        std::vector<UpdateExt> missing;
+        for (const auto *v : {&local_unmerged, &recv_unmerged}) {
+          for (const auto &u : *v) {
+            if (!state_vector_covers(have, u)) missing.push_back(u);
+          }
+        }
+        join_frame_state(g_user_id.c_str(), g_next_msg_id++, JOIN_OPS, Document(), have, missing, {}, frames);
+        lines_sent = 0;
+      } else {
+        join_frame_state(g_user_id.c_str(), g_next_msg_id++, JOIN_FULL, merge_baseline, merged_sv, local_unmerged,
+                         recv_unmerged, frames);
+        lines_sent = merge_baseline.size();
+      }
+    }
+    // A repeated request replaces a transfer still queued for the peer
+    size_t idx = static_cast<size_t>(peer - g_peers.peers);
+    join_out[idx].assign(std::make_move_iterator(frames.begin()), std::make_move_iterator(frames.end()));
+    join_out_gen[idx] = peer->generation;
+    std::printf("Sending document state to %s (%zu lines, %zu frames)\n", from, lines_sent, join_out[idx].size());
+    flush_join(*peer);
+  };
+
+  // Newcomer: adopt the peer's baseline; buffered updates already folded into
+  // it (state vector) or carried in the transfer are dropped as duplicates.
+  // A JOIN_OPS reply keeps our own baseline and only queues the carried ops.
+  auto install_state = [&](JoinState &state, std::vector<UpdateExt> &recv) {
+    joining = false;
+    std::set<std::pair<uint16_t, uint64_t>> carried;
+    for (const auto &u : state.ops) carried.emplace(u.rid, u.ts);
+    if (state.kind == JOIN_OPS) {
+      recv.erase(std::remove_if(recv.begin(), recv.end(),
+                                [&](const UpdateExt &u) { return carried.count({u.rid, u.ts}) > 0; }),
+                 recv.end());
+      size_t added = 0;
+      for (const auto &u : state.ops) {
+        if (state_vector_covers(merged_sv, u)) continue;
+        recv.push_back(update_store(pending_text, u));
+        hlc_update(g_clock, u.ts);
+        ++added;
+      }
+      std::printf("Caught up: %zu updates received\n", added);
+      return;
+    }
+    auto covered = [&](const UpdateExt &u) {
+      return state_vector_covers(state.sv, u) || carried.count({u.rid, u.ts}) > 0;
+    };
+    recv.erase(std::remove_if(recv.begin(), recv.end(), covered), recv.end());
+    std::vector<UpdateExt> ops;
+    ops.reserve(state.ops.size() + recv.size());
+    for (const auto &u : state.ops) ops.push_back(update_store(pending_text, u));
+    ops.insert(ops.end(), recv.begin(), recv.end());
+    recv = std::move(ops);
+    for (const auto &kv : state.sv) hlc_update(g_clock, kv.second);
+    for (const auto &u : state.ops) hlc_update(g_clock, u.ts);
+
+    merged_sv = state.sv;
+    std::printf("Joined: %zu lines and %zu pending updates received\n", state.doc.size(), state.ops.size());
+    write_merged(state.doc);
+    if (oplog_snapshot(oplog, merge_baseline, merged_sv) != 0) {
+      std::fprintf(stderr, "Failed to write %s\n", oplog.snap_path.c_str());
+    }
+  };
+  joining = request_state(); // also after a restart: peers do not resend what we missed (peers.h)
+
   // Track time of last local operation to support idle-time broadcast flush
   [[maybe_unused]] uint64_t last_local_op_ns = 0;
-  auto to_ext = [](const UpdateMessage &m) {
+  // Pending update record; its text is copied into pending_text
+  const uint16_t self_rid = replica_intern(g_user_id);
+  auto to_ext = [&](const auto &m, uint16_t rid) {
     UpdateExt e;
-    e.ts = m.timestamp_ns;
-    e.uid = std::string(m.sender);
+    e.ts = m.hlc;
+    e.rid = rid;
     e.line = m.line;
     e.cs = m.col_start;
     e.ce = m.col_end;
     e.op = m.op;
-    e.old_text = std::string(m.old_text);
-    e.new_text = std::string(m.new_text);
+    e.old_text = pending_text.store(m.old_text);
+    e.new_text = pending_text.store(m.new_text);
     return e;
   };
-  auto change_to_ext = [&](const Change &c) {
-    UpdateExt e;
-    e.ts = now_ns();
-    e.uid = g_user_id;
-    e.line = static_cast<uint32_t>(c.line);
-    e.cs = c.col_start;
-    e.ce = c.col_end;
-    if (c.type == "insert") e.op = OpType::Insert; else if (c.type == "delete") e.op = OpType::Delete; else e.op = OpType::Replace;
-    e.old_text = c.old_text;
-    e.new_text = c.new_text;
-    return e;
+  // CRDT functions are now in crdt.cpp
+
+  // Sequence CRDT op record; an insert keeps its text, a delete the deleted
+  // text (for its length)
+  auto to_seq = [&](const auto &m, uint16_t rid) {
+    SeqOp op;
+    op.op = m.op;
+    op.ts = m.hlc;
+    op.rid = rid;
+    op.ref_ts = m.ref_ts;
+    op.ref_rid = m.ref_ts != 0 ? replica_intern(m.ref_author) : REPLICA_NONE;
+    op.text = pending_text.store(m.op == OpType::SeqInsert ? m.new_text : m.old_text);
+    return op;
+  };
+  // Local edits in sequence CRDT mode: each is applied to seq at once and
+  // queued for broadcast like any other op
+  std::vector<SeqSpan> spans;
+  auto seq_insert = [&](size_t p, std::string text, const Change &c) {
+    if (text.empty()) return;
+    UpdateMessage um{};
+    stamp_message(um);
+    hlc_update(g_clock, um.hlc + text.size() - 1); // the characters take ts .. ts+n-1
+    uint16_t ref_rid;
+    seq.origin_at(p, um.ref_ts, ref_rid);
+    if (um.ref_ts != 0) um.ref_author = replica_name(ref_rid);
+    um.line = static_cast<uint32_t>(c.line);
+    um.col_start = c.col_start;
+    um.col_end = c.col_end;
+    um.op = OpType::SeqInsert;
+    um.new_text = std::move(text);
+    seq.apply(SeqOp{um.op, um.hlc, self_rid, um.ref_ts, ref_rid, um.new_text});
+    local_ops.push_back(std::move(um));
+  };
+  // One op per run of consecutive ids in the deleted range
+  auto seq_delete = [&](size_t p, std::string_view text, const Change &c) {
+    seq.spans(p, text.size(), spans);
+    size_t done = 0;
+    for (const auto &sp : spans) {
+      UpdateMessage um{};
+      stamp_message(um);
+      um.ref_ts = sp.ts;
+      um.ref_author = replica_name(sp.rid);
+      um.line = static_cast<uint32_t>(c.line);
+      um.col_start = c.col_start;
+      um.col_end = c.col_end;
+      um.op = OpType::SeqDelete;
+      um.old_text = text.substr(done, sp.len);
+      done += sp.len;
+      seq.apply(SeqOp{um.op, um.hlc, self_rid, sp.ts, sp.rid, um.old_text});
+      local_ops.push_back(std::move(um));
+    }
+  };
+  // A line change in seq coordinates. Changes come in an order in which each
+  // is valid after the ones before it (see the diff in the main loop).
+  auto record_seq = [&](const Change &c) {
+    local_edits++;
+    size_t start = seq.line_start(static_cast<size_t>(c.line));
+    if (c.type == "insert_line") {
+      if (start != std::string::npos) seq_insert(start, c.new_text + "\n", c);
+      else seq_insert(seq.size(), "\n" + c.new_text, c); // after an unterminated last line
+      return;
+    }
+    if (start == std::string::npos) return;
+    if (c.type == "delete_line") {
+      size_t end = seq.line_start(static_cast<size_t>(c.line) + 1);
+      std::string text = c.old_text + "\n";
+      if (end == std::string::npos) text.pop_back(); // unterminated last line
+      seq_delete(start, text, c);
+      return;
+    }
+    size_t p = start + static_cast<size_t>(c.col_start);
+    seq_delete(p, c.old_text, c);
+    seq_insert(p, c.new_text, c);
+  };
+  // Newcomer in sequence CRDT mode: adopt the peer's sequence, then re-apply
+  // our own ops of this run (those the peer already has are duplicates)
+  auto install_seq = [&](const std::string &payload) {
+    SeqDoc fresh;
+    const char *p = payload.data();
+    const char *end = p + payload.size();
+    if (!fresh.decode(p, end) || p != end) return false;
+    joining = false;
+    seq = std::move(fresh);
+    for (const auto &m : history) seq.apply(to_seq(m, self_rid));
+    for (const auto &m : local_ops) seq.apply(to_seq(m, self_rid));
+    hlc_update(g_clock, seq.max_ts());
+    std::printf("Joined: %zu lines and %zu parked updates received\n", seq.newlines(), seq.parked());
+    Document merged = seq.lines();
+    write_merged(merged);
+    return true;
   };
 
-  // CRDT functions are now in crdt.cpp
+  // Version vectors and join handshake frames
+  auto on_control = [&](const char *data, size_t n) {
+    VvSummary summary;
+    if (vv_parse(data, n, summary)) {
+      on_vv(summary);
+      return;
+    }
+    char from[USER_ID_MAX];
+    StateVector have;
+    if (join_parse_request(data, n, from, have)) {
+      // Two users joining at once would wait on each other: the lower
+      // registry slot gives up its own join and serves the other
+      PeerConn *req = peers_find(g_peers, from);
+      if (joining && req && req - g_peers.peers > g_peers.self_slot) {
+        joining = false;
+        std::printf("Peer %s is joining too, keeping the local copy\n", from);
+      }
+      if (!joining) serve_join(from, have);
+      return;
+    }
+    if (!joining) return;
+    int r;
+    if (use_rga) {
+      std::string payload;
+      r = join_asm.feed_payload(data, n, payload);
+      if (r > 0 && !install_seq(payload)) r = -1;
+    } else {
+      JoinState state;
+      r = join_asm.feed(data, n, state);
+      if (r > 0) install_state(state, recv_unmerged);
+    }
+    if (r < 0) join_asm.reset();
+    // A transfer that is making progress is not timed out
+    else if (r == 0) join_deadline_ns = now_ns() + static_cast<uint64_t>(JOIN_TIMEOUT_MS) * 1000000ull;
+  };
+
+  // Decode received frames in place: control frames are handled, updates go
+  // to recv_unmerged, or recv_seq in sequence CRDT mode (filtering out self
+  // and anything vv.h rejects). Each slot is released as soon as it is
+  // decoded. True if any update was new.
+  WireReassembler reasm;
+  std::vector<UpdateView> views;
+  std::set<std::string> ahead_warned; // authors reported as stamping ahead
+  bool replica_full_warned = false;
+  auto drain_recv = [&]() {
+    bool got = false;
+    while (RecvFrame *f = g_recv_frames.front()) {
+      if (wire_is_control(f->data, f->len)) {
+        on_control(f->data, f->len);
+      } else {
+        views.clear();
+        if (!reasm.feed(f->data, f->len, views)) g_recv_dropped.fetch_add(1, std::memory_order_relaxed);
+        for (const auto &v : views) {
+          // Later local ops order after everything seen (an insert's characters
+          // take ts .. ts+n-1)
+          bool chars = v.op == OpType::SeqInsert && !v.new_text.empty();
+          uint64_t last_ts = chars ? v.hlc + v.new_text.size() - 1 : v.hlc;
+          hlc_update(g_clock, last_ts);
+          g_recv_total.fetch_add(1, std::memory_order_relaxed);
+          // Skip messages from self
+          if (v.sender == g_peers.self_slot) continue;
+          // A user that registered since the last refresh is in the registry.
+          // Frames still queued from a user who left carry the slot's old
+          // generation and are dropped rather than credited to its next owner.
+          PeerConn &from = g_peers.peers[v.sender];
+          if (!from.active || from.generation != v.sender_gen) peers_refresh(g_peers, g_registry_seg);
+          if (!from.active || from.generation != v.sender_gen) {
+            g_recv_stale.fetch_add(1, std::memory_order_relaxed);
+            continue;
+          }
+          // An op stamped far ahead would win every LWW conflict until our
+          // clock got there. It is not admitted, so the author keeps resending
+          // it (vv.h) and it merges, with its own ts, once within the drift.
+          if (hlc_ahead(last_ts)) {
+            g_recv_ahead.fetch_add(1, std::memory_order_relaxed);
+            if (ahead_warned.insert(from.user_id).second) {
+              std::fprintf(stderr, "Holding back updates from %s: stamped over a minute ahead of our clock\n",
+                           from.user_id);
+            }
+            continue;
+          }
+          // Ids for the author and the op's reference, before the op counts
+          // as received
+          if (from.replica == REPLICA_NONE || (v.ref_ts != 0 && replica_intern(v.ref_author) == REPLICA_NONE)) {
+            g_recv_dropped.fetch_add(1, std::memory_order_relaxed);
+            if (!replica_full_warned) std::fprintf(stderr, "Replica table full: dropping updates from new users\n");
+            replica_full_warned = true;
+            continue;
+          }
+          if (!admit_remote(v, from)) continue;
+          if (op_is_seq(v.op) != use_rga) continue; // sender runs the other merge mode
+          if (use_rga) recv_seq.push_back(to_seq(v, from.replica));
+          else recv_unmerged.push_back(to_ext(v, from.replica));
+          got = true;
+          // Track last sender
+          std::snprintf(g_last_sender, USER_ID_MAX, "%s", from.user_id);
+        }
+      }
+      g_recv_frames.release();
+      release_listener();
+    }
+    return got;
+  };
+
+  uint32_t events = WATCH_FILE; // check the document on the first pass
+  bool reread = false;          // the last read failed: retry without waiting for an event
 
-  bool just_merged = false;  // Flag to prevent detecting merge writes as user changes
-  
   while (true) {
-    // Refresh active users every iteration
-    size_t old_ucount = ucount;
-    ucount = 0;
-    registry_list(g_registry_seg, users, ucount);
-    active_users.assign(users, users + ucount);
-    
-    // If active users changed, refresh display
-    bool users_changed = (ucount != old_ucount);
+    // Sync the peer table with the registry (shared-memory reads only unless
+    // a slot changed owner); if active users changed, refresh display
+    bool users_changed = peers_refresh(g_peers, g_registry_seg);
 
     // Defer sleeping to the end of the iteration so we can immediately
     // process any received updates and merges without waiting.
 
     // Drain received messages into recv_unmerged (filter out self)
-    bool got_remote_updates = false;
-    for (;;) {
-      UpdateMessage tmp;
-      if (!g_recv_buf.pop(tmp)) break;
-      // Skip messages from self
-      if (std::strncmp(tmp.sender, g_user_id.c_str(), USER_ID_MAX) == 0) continue;
-      recv_unmerged.push_back(to_ext(tmp));
-      got_remote_updates = true;
-      // Track last sender
-      std::snprintf(g_last_sender, USER_ID_MAX, "%s", tmp.sender);
-    }
+    bool got_remote_updates = drain_recv();
     
+    if (joining && now_ns() >= join_deadline_ns) {
+      joining = request_state();
+      if (!joining) std::printf("No document state received, continuing with the local copy\n");
+    }
+
     // Show received updates message and refresh display
     if (got_remote_updates && g_last_sender[0] != '\0') {
       std::cout << "Received update from " << g_last_sender << "\n";
-      render_display(doc_name, prev_lines, active_users, nullptr);
+      render_display(doc_name, prev_lines, nullptr);
     }
     
     // If users changed, refresh display
     if (users_changed && !got_remote_updates) {
-      render_display(doc_name, prev_lines, active_users, nullptr);
+      render_display(doc_name, prev_lines, nullptr);
     }
-    if (stat(doc_name.c_str(), &st) != 0) {
-      continue;
+    // Only touch the file when the watcher reported activity on it. A changed
+    // stamp (ns mtime, size, inode) means a new version; an inotify event with
+    // an unchanged stamp can still be a same-size save within one timestamp
+    // tick, so it is re-read too and the content hash below settles it.
+    FileStamp cur_stamp;
+    // Retry a failed merge write first, while the file is still the version
+    // prev_lines describes (or gone); a newer save is diffed and then merged
+    if (write_failed && (!doc_stamp(doc_name.c_str(), cur_stamp) || cur_stamp == last_stamp)) {
+      Document unwritten = merge_baseline;
+      write_merged(unwritten);
     }
-    
-    // If we just merged, simply reset the flag; do not skip processing of received updates
-    if (just_merged) {
-      just_merged = false;
+    bool doc_touched = ((events & WATCH_FILE) || reread) && doc_stamp(doc_name.c_str(), cur_stamp) &&
+                       (cur_stamp != last_stamp || !g_watcher.polling);
+
+    MappedDoc new_doc;
+    if (doc_touched && doc_map(doc_name.c_str(), new_doc) != 0) {
+      // Unreadable right now: an empty view would read as every line deleted.
+      // last_stamp is kept, so the next pass tries again.
+      if (!reread) std::fprintf(stderr, "Cannot read %s: %s\n", doc_name.c_str(), std::strerror(errno));
+      reread = true;
+      doc_touched = false;
+    } else if (doc_touched) {
+      reread = false;
     }
-    
-    if (st.st_mtime != last_mtime) {
-      last_mtime = st.st_mtime;
-      auto new_lines = read_lines(doc_name);
-
-      // Detect changes line-by-line (minimal-span diff per line)
-      Change last_change{ -1, -1, -1, "", "", now_time_str(), g_user_id, "none" };
-      bool has_changes = false;
-
-      // Compare line by line against prev_lines (last known state)
-      size_t common_lines = std::min(prev_lines.size(), new_lines.size());
-      for (size_t i = 0; i < common_lines; ++i) {
-        const std::string &oldL = prev_lines[i];
-        const std::string &newL = new_lines[i];
-        if (oldL == newL) continue;
-
-        // Compute minimal differing span: cs (first diff), tail (common suffix)
-        int old_len = static_cast<int>(oldL.size());
-        int new_len = static_cast<int>(newL.size());
-        int cs = 0;
-        int max_common_left = std::min(old_len, new_len);
-        while (cs < max_common_left && oldL[cs] == newL[cs]) cs++;
-
-        int tail = 0;
-        while (tail < (old_len - cs) && tail < (new_len - cs) &&
-               oldL[old_len - 1 - tail] == newL[new_len - 1 - tail]) {
-          tail++;
+
+    if (doc_touched) {
+      last_stamp = new_doc.stamp;
+      const auto &new_lines = new_doc.lines; // views into the mapping
+      doc_layout(new_doc, disk_layout);
+      std::vector<uint64_t> new_hashes;
+      uint64_t new_file_hash = hash_lines(new_lines, new_hashes);
+
+      // A save that did not change content (touch, or our own merge write-back)
+      // costs one integer compare
+      if (new_file_hash != prev_file_hash) {
+        // Detect changes: line-level diff, then minimal span within edited lines
+        Change last_change{ -1, -1, -1, "", "", now_time_str(), g_user_id, "none" };
+        bool has_changes = false;
+        auto record_change = [&](int line, int cs, int ce, std::string old_text, std::string new_text, const char *type) {
+          if (revert_save) return; // until the write-back, prev_lines holds unrecorded text
+          last_change.line = line;
+          last_change.col_start = cs;
+          last_change.col_end = ce;
+          last_change.old_text = std::move(old_text);
+          last_change.new_text = std::move(new_text);
+          last_change.type = type;
+          has_changes = true;
+
+          // Buffer operation for broadcast and merge
+          if (use_rga) {
+            record_seq(last_change);
+            last_local_op_ns = now_ns();
+            return;
+          }
+          UpdateMessage um{};
+          to_message(last_change, um);
+          local_unmerged.push_back(to_ext(um, self_rid));
+          local_ops.push_back(std::move(um));
+          last_local_op_ns = now_ns();
+        };
+
+        // Diff against prev_lines (last known state) by cached line fingerprint
+        std::vector<const std::string *> old_view;
+        old_view.reserve(prev_lines.size());
+        prev_lines.for_each([&](size_t, const std::string &l) { old_view.push_back(&l); });
+        auto hunks = diff_lines(prev_hashes, new_hashes);
+
+        // A save is recorded whole or not at all: ops over WIRE_OP_MAX would be
+        // dropped by every peer, so a save that needs one is refused and the
+        // file is written back without it
+        int oversized = -1;
+        for (const auto &h : hunks) {
+          size_t paired = std::min(h.old_len, h.new_len);
+          for (size_t t = 0; t < std::max(h.old_len, h.new_len) && oversized < 0; ++t) {
+            size_t old_n = t < h.old_len ? old_view[h.old_pos + t]->size() + 1 : 0;
+            size_t new_n = t < h.new_len ? new_lines[h.new_pos + t].size() + 1 : 0;
+            if (wire_op_fits(old_n + new_n)) continue;
+            int cs;
+            std::string old_seg, new_seg;
+            if (t < paired && diff_line_span(*old_view[h.old_pos + t], new_lines[h.new_pos + t], cs, old_seg, new_seg) &&
+                wire_op_fits(old_seg.size() + new_seg.size())) {
+              continue;
+            }
+            oversized = static_cast<int>(h.old_pos + t);
+          }
+        }
+        if (oversized >= 0) {
+          std::fprintf(stderr, "Line %d: edit is over the %zu MiB update limit; reverting the save\n",
+                       oversized + 1, WIRE_OP_MAX >> 20);
+          revert_save = true;
         }
 
-        int old_mid_len = old_len - cs - tail;
-        int new_mid_len = new_len - cs - tail;
-        std::string old_seg = (old_mid_len > 0) ? oldL.substr(cs, old_mid_len) : std::string();
-        std::string new_seg = (new_mid_len > 0) ? newL.substr(cs, new_mid_len) : std::string();
-
-        // Skip no-op
-        if (old_seg == new_seg) continue;
-
-        // Determine operation type
-        std::string op_type;
-        if (old_seg.empty() && !new_seg.empty()) op_type = "insert";
-        else if (!old_seg.empty() && new_seg.empty()) op_type = "delete";
-        else op_type = "replace";
-
-        // Populate precise change
-        last_change.line = static_cast<int>(i);
-        last_change.col_start = cs;
-        last_change.col_end = old_seg.empty() ? cs : (cs + static_cast<int>(old_seg.size()) - 1);
-        last_change.old_text = old_seg;
-        last_change.new_text = new_seg;
-        last_change.type = op_type;
-        has_changes = true;
-
-        // Buffer operation for broadcast and merge
-        UpdateMessage um{};
-        to_message(last_change, um);
-        local_ops.push_back(um);
-        local_unmerged.push_back(change_to_ext(last_change));
-        last_local_op_ns = now_ns();
-      }
-      
-      // Handle line additions (new lines added at end)
-      for (size_t i = prev_lines.size(); i < new_lines.size(); ++i) {
-        // Ignore trailing empty line insertions
-        if (new_lines[i].empty()) continue;
-        last_change.line = static_cast<int>(i);
-        last_change.col_start = 0;
-        last_change.col_end = 0; // insert at start for whole new line
-        last_change.old_text = "";
-        last_change.new_text = new_lines[i];
-        last_change.type = "insert";
-        has_changes = true;
-
-        UpdateMessage um{};
-        to_message(last_change, um);
-        local_ops.push_back(um);
-        local_unmerged.push_back(change_to_ext(last_change));
-        last_local_op_ns = now_ns();
-      }
-      
-      // Handle line deletions (lines removed from end)
-      for (size_t i = new_lines.size(); i < prev_lines.size(); ++i) {
-        // Ignore trailing empty line deletions
-        if (prev_lines[i].empty()) continue;
-        last_change.line = static_cast<int>(i);
-        last_change.col_start = 0;
-        last_change.col_end = static_cast<int>(prev_lines[i].size()) - 1; // inclusive end
-        last_change.old_text = prev_lines[i];
-        last_change.new_text = "";
-        last_change.type = "delete";
-        has_changes = true;
-
-        UpdateMessage um{};
-        to_message(last_change, um);
-        local_ops.push_back(um);
-        local_unmerged.push_back(change_to_ext(last_change));
-        last_local_op_ns = now_ns();
-      }
+        // Paired lines of each hunk are edits in place, in old coordinates
+        for (const auto &h : hunks) {
+          size_t paired = std::min(h.old_len, h.new_len);
+          for (size_t t = 0; t < paired; ++t) {
+            const std::string &oldL = *old_view[h.old_pos + t];
+            std::string_view newL = new_lines[h.new_pos + t];
+            int cs;
+            std::string old_seg, new_seg;
+            if (!diff_line_span(oldL, newL, cs, old_seg, new_seg)) continue; // Skip no-op
 
-      prev_lines = std::move(new_lines);
-      if (has_changes) {
-        render_display(doc_name, prev_lines, active_users, &last_change);
+            // Determine operation type
+            const char *op_type;
+            if (old_seg.empty() && !new_seg.empty()) op_type = "insert";
+            else if (!old_seg.empty() && new_seg.empty()) op_type = "delete";
+            else op_type = "replace";
+            int ce = old_seg.empty() ? cs : (cs + static_cast<int>(old_seg.size()) - 1);
+            record_change(static_cast<int>(h.old_pos + t), cs, ce, std::move(old_seg), std::move(new_seg), op_type);
+          }
+        }
+
+        // Then whole-line deletes/inserts, bottom-up so every op's line number
+        // is valid both in the old file and after the ops recorded before it
+        for (auto it = hunks.rbegin(); it != hunks.rend(); ++it) {
+          const auto &h = *it;
+          size_t paired = std::min(h.old_len, h.new_len);
+          for (size_t t = h.old_len; t-- > paired;) {
+            const std::string &oldL = *old_view[h.old_pos + t];
+            record_change(static_cast<int>(h.old_pos + t), 0, static_cast<int>(oldL.size()) - 1, oldL, "", "delete_line");
+          }
+          for (size_t t = paired; t < h.new_len; ++t) {
+            record_change(static_cast<int>(h.old_pos + t), 0, 0, "", std::string(new_lines[h.new_pos + t]), "insert_line");
+          }
+        }
+
+        // Bring prev_lines up to date in place: only lines inside hunks are
+        // copied out of the mapping, unchanged lines stay shared
+        for (auto it = hunks.rbegin(); it != hunks.rend(); ++it) {
+          const auto &h = *it;
+          size_t paired = std::min(h.old_len, h.new_len);
+          for (size_t t = 0; t < paired; ++t) {
+            if (prev_hashes[h.old_pos + t] != new_hashes[h.new_pos + t]) {
+              prev_lines.set(h.old_pos + t, std::string(new_lines[h.new_pos + t]));
+            }
+          }
+          for (size_t t = h.old_len; t-- > paired;) prev_lines.erase(h.old_pos + t);
+          for (size_t t = paired; t < h.new_len; ++t) {
+            prev_lines.insert(h.old_pos + t, std::string(new_lines[h.new_pos + t]));
+          }
+        }
+        prev_hashes = std::move(new_hashes);
+        prev_file_hash = new_file_hash;
+        if (has_changes) {
+          render_display(doc_name, prev_lines, &last_change);
+        }
       }
+      doc_unmap(new_doc);
     }
 
     // Part 3: Merge and synchronize BEFORE broadcasting
     // "After receiving updates OR after every N=5 operations (whichever comes first)"
     const size_t N_MERGE = 5;
-    bool should_merge = !recv_unmerged.empty() || (local_unmerged.size() >= N_MERGE);
+    bool should_merge = write_failed || revert_save || (use_rga ? !recv_seq.empty()
+                                                 : !recv_unmerged.empty() || (local_unmerged.size() >= N_MERGE));
     // Do NOT merge if there are unprocessed local file changes
-    struct stat st_now{};
-    bool local_dirty = (stat(doc_name.c_str(), &st_now) == 0) && (st_now.st_mtime != last_mtime);
-    if (should_merge && !local_dirty) {
-      auto lines_copy = merge_baseline; // Start from merge baseline (pre-local-changes)
-      bool changed = do_merge_apply(lines_copy, local_unmerged, recv_unmerged, g_user_id);
-      if (changed) {
-        // Trim trailing empty lines prior to write to avoid phantom blanks
-        while (!lines_copy.empty() && lines_copy.back().empty()) lines_copy.pop_back();
-        // Write back to file
-        std::ofstream ofs(doc_name);
-        for (size_t i = 0; i < lines_copy.size(); ++i) {
-          ofs << lines_copy[i] << "\n";
-        }
-        ofs.flush();
-        ofs.close();
-        
-        // Update local states before mtime refresh
-        prev_lines = lines_copy;
-        merge_baseline = lines_copy; // Reset baseline after merge
-        
-        // Update mtime AFTER writing to prevent re-detection of merge
-        if (stat(doc_name.c_str(), &st) == 0) {
-          last_mtime = st.st_mtime;
-        }
-        
-        std::cout << "All updates merged successfully\n";
-        render_display(doc_name, prev_lines, active_users, nullptr);
-        
-        just_merged = true;
-        std::this_thread::sleep_for(std::chrono::milliseconds(200));
-      }
+    FileStamp now_stamp;
+    bool local_dirty = doc_stamp(doc_name.c_str(), now_stamp) && now_stamp != last_stamp;
+    if (should_merge && !local_dirty && !joining) {
+      merge_pending();
     }
 
     // Quick re-drain after merge to catch late arrivals and merge again
-    bool got_more_after_merge = false;
-    for (;;) {
-      UpdateMessage tmp2;
-      if (!g_recv_buf.pop(tmp2)) break;
-      if (std::strncmp(tmp2.sender, g_user_id.c_str(), USER_ID_MAX) == 0) continue;
-      recv_unmerged.push_back(to_ext(tmp2));
-      got_more_after_merge = true;
-      std::snprintf(g_last_sender, USER_ID_MAX, "%s", tmp2.sender);
-    }
-    if (got_more_after_merge && !local_dirty) {
-      auto lines_copy2 = merge_baseline;
-      bool changed2 = do_merge_apply(lines_copy2, local_unmerged, recv_unmerged, g_user_id);
-      if (changed2) {
-        while (!lines_copy2.empty() && lines_copy2.back().empty()) lines_copy2.pop_back();
-        std::ofstream ofs2(doc_name);
-        for (size_t i = 0; i < lines_copy2.size(); ++i) {
-          ofs2 << lines_copy2[i] << "\n";
-        }
-        ofs2.flush();
-        ofs2.close();
-        prev_lines = lines_copy2;
-        merge_baseline = lines_copy2;
-        if (stat(doc_name.c_str(), &st) == 0) {
-          last_mtime = st.st_mtime;
-        }
-        std::cout << "All updates merged successfully\n";
-        render_display(doc_name, prev_lines, active_users, nullptr);
-      }
+    bool got_more_after_merge = drain_recv();
+    if (got_more_after_merge && !local_dirty && !joining) {
+      merge_pending();
     }
 
-    // Part 2: Broadcast after accumulating exactly 5 operations (as per assignment)
+    // Part 2: Broadcast once 5 operations have accumulated (as per assignment;
+    // edits in sequence CRDT mode).
     const size_t N_BROADCAST = 5;
-    if (local_ops.size() >= N_BROADCAST) {
-        std::cout << "Broadcasting " << N_BROADCAST << " operations...\n";
-        // Refresh active users list before broadcasting
-        ucount = 0;
-        registry_list(g_registry_seg, users, ucount);
-        
-        for (size_t idx = 0; idx < ucount; ++idx) {
-          const auto &u = users[idx];
-          if (std::strncmp(u.user_id, g_user_id.c_str(), USER_ID_MAX) == 0) continue; // skip self
-          if (u.queue_name[0] == '\0') continue;
-          mqd_t mq_other = mq_open(u.queue_name, O_WRONLY | O_NONBLOCK);
-          if (mq_other == (mqd_t)-1) continue;
-          
-          // Send exactly N_BROADCAST operations
-          size_t count = 0;
-          for (const auto& op : local_ops) {
-            if (count >= N_BROADCAST) break;
-            if (mq_send(mq_other, reinterpret_cast<const char*>(&op), sizeof(UpdateMessage), 0) == 0) {
-              g_sent_total.fetch_add(1, std::memory_order_relaxed);
-              std::snprintf(g_last_target, USER_ID_MAX, "%s", u.user_id);
-              count++;
-            }
-          }
-          mq_close(mq_other);
-        }
-        
-        // Remove the sent operations from local_ops
-        if (local_ops.size() > N_BROADCAST) {
-          local_ops.erase(local_ops.begin(), local_ops.begin() + N_BROADCAST);
-        } else {
-          local_ops.clear();
-        }
+    if ((use_rga ? local_edits : local_ops.size()) >= N_BROADCAST) {
+      broadcast_local(nullptr);
+    }
+
+    // Anti-entropy round VV_SYNC_MS after something became unconfirmed, then
+    // every VV_SYNC_MS until everything is
+    uint64_t now = now_ns();
+    bool pending_sync = sync_pending();
+    if (!pending_sync) {
+      next_sync_ns = now + static_cast<uint64_t>(VV_SYNC_MS) * 1000000ull;
+    } else if (now >= next_sync_ns) {
+      sync_round();
+      next_sync_ns = now + static_cast<uint64_t>(VV_SYNC_MS) * 1000000ull;
     }
 
-    // Fixed 2-second polling interval as per assignment
-    std::this_thread::sleep_for(std::chrono::seconds(2));
+    // Sleep until the document is saved or the listener delivers updates.
+    // The timeout keeps the active-user list fresh; in polling fallback mode
+    // it is the original fixed 2-second interval.
+    int wait_ms = joining ? JOIN_TIMEOUT_MS / 4 : WATCH_POLL_MS;
+    if (reread || write_failed) wait_ms = std::min(wait_ms, DOC_RETRY_MS);
+    int retry_ms = catch_up();
+    if (retry_ms >= 0) wait_ms = std::min(wait_ms, retry_ms);
+    if (pending_sync) wait_ms = std::min<int>(wait_ms, static_cast<int>((next_sync_ns - now) / 1000000ull) + 1);
+    events = watcher_wait(g_watcher, wait_ms);
   }
 }
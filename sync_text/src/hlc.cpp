@@ -0,0 +1,31 @@
+#include "../include/hlc.h"
+
+#include <chrono>
+
+static uint64_t wall_ms() {
+  using namespace std::chrono;
+  return static_cast<uint64_t>(duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count());
+}
+
+uint64_t hlc_now(Hlc &c) {
+  uint64_t phys = wall_ms() << HLC_LOGICAL_BITS;
+  uint64_t last = c.last.load(std::memory_order_relaxed);
+  uint64_t next;
+  do {
+    // Same or earlier millisecond: bump the counter. Counter overflow carries
+    // into the millisecond field, which keeps the order total.
+    next = last < phys ? phys : last + 1;
+  } while (!c.last.compare_exchange_weak(last, next, std::memory_order_relaxed));
+  return next;
+}
+
+bool hlc_ahead(uint64_t t) {
+  return hlc_physical_ms(t) > wall_ms() + HLC_MAX_DRIFT_MS;
+}
+
+void hlc_update(Hlc &c, uint64_t remote) {
+  if (hlc_ahead(remote)) return;
+  uint64_t last = c.last.load(std::memory_order_relaxed);
+  while (remote > last && !c.last.compare_exchange_weak(last, remote, std::memory_order_relaxed)) {
+  }
+}
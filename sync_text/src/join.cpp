@@ -0,0 +1,161 @@
+#include "../include/join.h"
+#include "../include/compress.h"
+#include "../include/oplog.h"
+#include "../include/wire.h"
+
+#include <algorithm>
+#include <cstring>
+
+static void put_header(std::string &f, FrameKind kind, const char *sender) {
+  f.push_back(static_cast<char>(WIRE_MAGIC));
+  f.push_back(static_cast<char>(kind));
+  wire_put_bytes(f, sender, strnlen(sender, USER_ID_MAX - 1));
+}
+
+static bool get_sender(const char *&p, const char *end, char sender[USER_ID_MAX]) {
+  const char *data;
+  std::size_t n;
+  if (!wire_get_bytes(p, end, data, n) || n >= USER_ID_MAX) return false;
+  std::memcpy(sender, data, n);
+  sender[n] = '\0';
+  return true;
+}
+
+static void put_sv(std::string &out, const StateVector &sv) {
+  wire_put_varint(out, sv.size());
+  for (const auto &kv : sv) {
+    wire_put_bytes(out, kv.first.data(), kv.first.size());
+    wire_put_varint(out, kv.second);
+  }
+}
+
+static bool get_sv(const char *&p, const char *end, StateVector &sv) {
+  uint64_t n;
+  if (!wire_get_varint(p, end, n)) return false;
+  sv.clear();
+  for (uint64_t i = 0; i < n; ++i) {
+    const char *data;
+    std::size_t len;
+    uint64_t ts;
+    if (!wire_get_bytes(p, end, data, len) || !wire_get_varint(p, end, ts)) return false;
+    sv[std::string(data, len)] = ts;
+  }
+  return true;
+}
+
+void join_frame_request(const char *sender, const StateVector &have, std::string &frame) {
+  frame.clear();
+  put_header(frame, FrameKind::JoinRequest, sender);
+  std::size_t header = frame.size();
+  put_sv(frame, have);
+  if (frame.size() > WIRE_MSG_MAX) {
+    // Too many authors for one frame: ask for the full state instead
+    frame.resize(header);
+    put_sv(frame, StateVector());
+  }
+}
+
+bool join_parse_request(const char *data, std::size_t n, char sender[USER_ID_MAX], StateVector &have) {
+  if (n < 2 || static_cast<FrameKind>(data[1]) != FrameKind::JoinRequest) return false;
+  const char *p = data + 2;
+  const char *end = data + n;
+  return get_sender(p, end, sender) && get_sv(p, end, have) && p == end;
+}
+
+void join_frame_state(const char *sender, uint64_t transfer_id, uint8_t kind, const Document &doc,
+                      const StateVector &sv, const std::vector<UpdateExt> &a, const std::vector<UpdateExt> &b,
+                      std::vector<std::string> &frames) {
+  std::string payload;
+  payload.push_back(static_cast<char>(kind));
+  wire_put_varint(payload, doc.size());
+  doc.for_each([&](std::size_t, const std::string &line) { wire_put_bytes(payload, line.data(), line.size()); });
+  put_sv(payload, sv);
+  oplog_encode_ops(a, b, payload);
+  join_frame_payload(sender, transfer_id, payload, frames);
+}
+
+void join_frame_payload(const char *sender, uint64_t transfer_id, const std::string &payload,
+                        std::vector<std::string> &frames) {
+  std::string packed;
+  lz_compress(payload.data(), payload.size(), packed);
+
+  // Chunk header: magic, kind, sender, transfer_id, index, count (<= 2+33+3*10 bytes)
+  const std::size_t header_max = 2 + 1 + USER_ID_MAX + 3 * 10;
+  const std::size_t chunk = WIRE_MSG_MAX - header_max;
+  uint64_t count = (packed.size() + chunk - 1) / chunk; // packed is never empty
+  for (uint64_t i = 0; i < count; ++i) {
+    std::string f;
+    put_header(f, FrameKind::StateChunk, sender);
+    wire_put_varint(f, transfer_id);
+    wire_put_varint(f, i);
+    wire_put_varint(f, count);
+    std::size_t off = static_cast<std::size_t>(i) * chunk;
+    f.append(packed, off, std::min(chunk, packed.size() - off));
+    frames.push_back(std::move(f));
+  }
+}
+
+static bool decode_state(JoinState &out) {
+  const char *p = out.payload.data();
+  const char *end = p + out.payload.size();
+  if (p == end) return false;
+  out.kind = static_cast<uint8_t>(*p++);
+  if (out.kind != JOIN_FULL && out.kind != JOIN_OPS) return false;
+  uint64_t n;
+  if (!wire_get_varint(p, end, n)) return false;
+  std::vector<std::string> lines;
+  for (uint64_t i = 0; i < n; ++i) {
+    const char *data;
+    std::size_t len;
+    if (!wire_get_bytes(p, end, data, len)) return false;
+    lines.emplace_back(data, len);
+  }
+  if (!get_sv(p, end, out.sv)) return false;
+  out.ops.clear();
+  if (!oplog_decode_ops(p, end, out.ops)) return false;
+  out.doc = Document(std::move(lines));
+  return true;
+}
+
+int StateAssembler::feed(const char *data, std::size_t n, JoinState &out) {
+  int r = feed_payload(data, n, out.payload);
+  if (r <= 0) return r;
+  return decode_state(out) ? 1 : -1;
+}
+
+int StateAssembler::feed_payload(const char *data, std::size_t n, std::string &payload) {
+  if (n < 2 || static_cast<FrameKind>(data[1]) != FrameKind::StateChunk) return -1;
+  const char *p = data + 2;
+  const char *end = data + n;
+  char from[USER_ID_MAX];
+  uint64_t id, index, count;
+  if (!get_sender(p, end, from) || !wire_get_varint(p, end, id) || !wire_get_varint(p, end, index) ||
+      !wire_get_varint(p, end, count) || count == 0 || index >= count || p == end ||
+      count > JOIN_MAX_STATE / (WIRE_MSG_MAX / 2)) {
+    return -1;
+  }
+  if (id != transfer_id || sender != from || parts.size() != count) {
+    reset();
+    sender = from;
+    transfer_id = id;
+    parts.resize(static_cast<std::size_t>(count));
+  }
+  std::string &part = parts[static_cast<std::size_t>(index)];
+  if (part.empty()) {
+    part.assign(p, end);
+    received++;
+  }
+  if (received < parts.size()) return 0;
+
+  std::string packed;
+  for (auto &s : parts) packed += s;
+  reset();
+  return lz_decompress(packed.data(), packed.size(), payload, JOIN_MAX_STATE) ? 1 : -1;
+}
+
+void StateAssembler::reset() {
+  sender.clear();
+  transfer_id = 0;
+  received = 0;
+  parts.clear();
+}
@@ -0,0 +1,290 @@
+#include "../include/oplog.h"
+#include "../include/docio.h"
+#include "../include/replica.h"
+#include "../include/wire.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+static constexpr std::size_t LOG_HEADER = 16;  // magic, version, gen
+static constexpr std::size_t SNAP_HEADER = 32; // magic, version, gen, max_ts, line count
+
+template <typename T>
+static void put_raw(std::string &out, T v) {
+  out.append(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+template <typename T>
+static T get_raw(const char *p) {
+  T v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static void encode_ext(const UpdateExt &u, std::string &out) {
+  std::string_view uid = replica_name(u.rid);
+  wire_put_bytes(out, uid.data(), uid.size());
+  wire_put_varint(out, u.ts);
+  wire_put_varint(out, u.line);
+  wire_put_varint(out, static_cast<uint32_t>(u.cs));
+  wire_put_varint(out, static_cast<uint32_t>(u.ce));
+  out.push_back(static_cast<char>(u.op));
+  wire_put_bytes(out, u.old_text.data(), u.old_text.size());
+  wire_put_bytes(out, u.new_text.data(), u.new_text.size());
+}
+
+static bool decode_ext(const char *&p, const char *end, UpdateExt &u) {
+  const char *data;
+  std::size_t n;
+  uint64_t line, cs, ce;
+  if (!wire_get_bytes(p, end, data, n)) return false;
+  u.rid = replica_intern(std::string_view(data, n));
+  if (u.rid == REPLICA_NONE) return false;
+  if (!wire_get_varint(p, end, u.ts) || !wire_get_varint(p, end, line) ||
+      !wire_get_varint(p, end, cs) || !wire_get_varint(p, end, ce) || p >= end) {
+    return false;
+  }
+  uint8_t op = static_cast<uint8_t>(*p++);
+  if (op < static_cast<uint8_t>(OpType::Insert) || op > static_cast<uint8_t>(OpType::LineDelete)) return false;
+  u.line = static_cast<uint32_t>(line);
+  u.cs = static_cast<int32_t>(static_cast<uint32_t>(cs));
+  u.ce = static_cast<int32_t>(static_cast<uint32_t>(ce));
+  u.op = static_cast<OpType>(op);
+  if (!wire_get_bytes(p, end, data, n)) return false;
+  u.old_text = std::string_view(data, n);
+  if (!wire_get_bytes(p, end, data, n)) return false;
+  u.new_text = std::string_view(data, n);
+  return true;
+}
+
+void oplog_encode_ops(const std::vector<UpdateExt> &a, const std::vector<UpdateExt> &b, std::string &out) {
+  std::string op;
+  wire_put_varint(out, a.size() + b.size());
+  for (const auto *v : {&a, &b}) {
+    for (const auto &u : *v) {
+      op.clear();
+      encode_ext(u, op);
+      wire_put_bytes(out, op.data(), op.size());
+    }
+  }
+}
+
+bool oplog_decode_ops(const char *&p, const char *end, std::vector<UpdateExt> &out) {
+  uint64_t count;
+  if (!wire_get_varint(p, end, count)) return false;
+  for (uint64_t i = 0; i < count; ++i) {
+    const char *op;
+    std::size_t op_n;
+    UpdateExt u;
+    if (!wire_get_bytes(p, end, op, op_n) || !decode_ext(op, op + op_n, u)) return false;
+    out.push_back(u);
+  }
+  return true;
+}
+
+static bool write_all(int fd, const char *p, std::size_t n) {
+  while (n > 0) {
+    ssize_t w = write(fd, p, n);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    p += w;
+    n -= static_cast<std::size_t>(w);
+  }
+  return true;
+}
+
+// Map a whole file read-only; size 0 => nullptr
+static const char *map_file(const std::string &path, std::size_t &size) {
+  size = 0;
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return nullptr;
+  struct stat st;
+  void *p = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    p = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (p == MAP_FAILED) return nullptr;
+  size = static_cast<std::size_t>(st.st_size);
+  return static_cast<const char *>(p);
+}
+
+// Start an empty log of generation gen (replacing any old one)
+static int start_log(OpLog &log, uint64_t gen) {
+  if (log.fd >= 0) close(log.fd);
+  log.fd = open(log.log_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (log.fd < 0) return -1;
+  std::string header;
+  put_raw(header, OPLOG_MAGIC);
+  put_raw(header, OPLOG_VERSION);
+  put_raw(header, gen);
+  if (!write_all(log.fd, header.data(), header.size()) || fdatasync(log.fd) != 0) return -2;
+  log.gen = gen;
+  log.ops_since_snapshot = 0;
+  return 0;
+}
+
+static bool load_snapshot(OpLog &log, Document &doc, StateVector &sv, uint64_t &covered_gen) {
+  std::size_t size;
+  const char *base = map_file(log.snap_path, size);
+  if (!base) return false;
+  const char *p = base + SNAP_HEADER;
+  const char *end = base + size;
+  bool ok = size >= SNAP_HEADER && get_raw<uint32_t>(base) == SNAPSHOT_MAGIC &&
+            get_raw<uint32_t>(base + 4) == SNAPSHOT_VERSION;
+  std::vector<std::string> lines;
+  StateVector snap_sv;
+  if (ok) {
+    covered_gen = get_raw<uint64_t>(base + 8);
+    log.max_ts = get_raw<uint64_t>(base + 16);
+    uint64_t count = get_raw<uint64_t>(base + 24);
+    lines.reserve(static_cast<std::size_t>(std::min<uint64_t>(count, size)));
+    for (uint64_t i = 0; ok && i < count; ++i) {
+      const char *data;
+      std::size_t n;
+      ok = wire_get_bytes(p, end, data, n);
+      if (ok) lines.emplace_back(data, n);
+    }
+    uint64_t sv_count = 0;
+    ok = ok && wire_get_varint(p, end, sv_count);
+    for (uint64_t i = 0; ok && i < sv_count; ++i) {
+      const char *data;
+      std::size_t n;
+      uint64_t ts;
+      ok = wire_get_bytes(p, end, data, n) && wire_get_varint(p, end, ts);
+      if (ok) snap_sv[std::string(data, n)] = ts;
+    }
+  }
+  munmap(const_cast<char *>(base), size);
+  if (ok) {
+    doc = Document(std::move(lines));
+    sv = std::move(snap_sv);
+  }
+  return ok;
+}
+
+// Replay complete batch records into doc; returns the offset after the last one
+static std::size_t replay(OpLog &log, const char *base, std::size_t size, Document &doc, StateVector &sv) {
+  const char *p = base + LOG_HEADER;
+  const char *end = base + size;
+  std::vector<UpdateExt> batch;
+  std::vector<UpdateExt> none;
+  std::size_t good = LOG_HEADER;
+  while (p < end) {
+    if (static_cast<uint8_t>(*p++) != OPLOG_BATCH) break;
+    const char *body;
+    std::size_t body_n;
+    if (!wire_get_bytes(p, end, body, body_n)) break; // torn tail
+    batch.clear();
+    if (!oplog_decode_ops(body, body + body_n, batch)) break;
+    for (const auto &u : batch) {
+      if (u.ts > log.max_ts) log.max_ts = u.ts;
+    }
+    // Same steps as the editor's merge + write-back
+    log.ops_since_snapshot += batch.size();
+    state_vector_add(sv, batch);
+    if (do_merge_apply(doc, batch, none, std::string())) {
+      while (!doc.empty() && doc.back().empty()) doc.pop_back();
+    }
+    good = static_cast<std::size_t>(p - base);
+  }
+  return good;
+}
+
+int oplog_open(OpLog &log, const std::string &user_id, Document &doc, StateVector &sv) {
+  log.log_path = user_id + "_ops.log";
+  log.snap_path = user_id + "_snapshot.bin";
+  log.pending.clear();
+
+  uint64_t covered_gen = 0;
+  Document recovered;
+  StateVector recovered_sv;
+  if (!load_snapshot(log, recovered, recovered_sv, covered_gen)) {
+    // No usable snapshot: a log on its own has no base to replay onto
+    log.gen = 0;
+    log.max_ts = 0;
+    return 0;
+  }
+
+  std::size_t size;
+  const char *base = map_file(log.log_path, size);
+  uint64_t log_gen = 0;
+  if (base && size >= LOG_HEADER && get_raw<uint32_t>(base) == OPLOG_MAGIC &&
+      get_raw<uint32_t>(base + 4) == OPLOG_VERSION) {
+    log_gen = get_raw<uint64_t>(base + 8);
+  }
+  if (log_gen <= covered_gen) {
+    // Missing, damaged or already folded into the snapshot
+    if (base) munmap(const_cast<char *>(base), size);
+    if (start_log(log, covered_gen + 1) != 0) return -1;
+    doc = std::move(recovered);
+    sv = std::move(recovered_sv);
+    return 1;
+  }
+
+  log.ops_since_snapshot = 0;
+  std::size_t good = replay(log, base, size, recovered, recovered_sv);
+  munmap(const_cast<char *>(base), size);
+
+  // Reopen for appending after the last complete record
+  log.fd = open(log.log_path.c_str(), O_WRONLY | O_CLOEXEC);
+  if (log.fd < 0) return -2;
+  if (ftruncate(log.fd, static_cast<off_t>(good)) != 0 || lseek(log.fd, 0, SEEK_END) < 0) return -3;
+  log.gen = log_gen;
+  doc = std::move(recovered);
+  sv = std::move(recovered_sv);
+  return 1;
+}
+
+void oplog_append(OpLog &log, const std::vector<UpdateExt> &local, const std::vector<UpdateExt> &recv) {
+  if (local.empty() && recv.empty()) return;
+  std::string body;
+  oplog_encode_ops(local, recv, body);
+  for (const auto *v : {&local, &recv}) {
+    for (const auto &u : *v) {
+      if (u.ts > log.max_ts) log.max_ts = u.ts;
+    }
+  }
+  log.pending.push_back(static_cast<char>(OPLOG_BATCH));
+  wire_put_bytes(log.pending, body.data(), body.size());
+  log.ops_since_snapshot += local.size() + recv.size();
+}
+
+int oplog_sync(OpLog &log) {
+  if (log.pending.empty()) return 0;
+  if (log.fd < 0) return -1;
+  bool ok = write_all(log.fd, log.pending.data(), log.pending.size()) && fdatasync(log.fd) == 0;
+  log.pending.clear();
+  return ok ? 0 : -2;
+}
+
+int oplog_snapshot(OpLog &log, const Document &doc, const StateVector &sv) {
+  if (oplog_sync(log) != 0 && log.fd >= 0) return -1;
+  std::string buf;
+  put_raw(buf, SNAPSHOT_MAGIC);
+  put_raw(buf, SNAPSHOT_VERSION);
+  put_raw(buf, log.gen);
+  put_raw(buf, log.max_ts);
+  put_raw(buf, static_cast<uint64_t>(doc.size()));
+  doc.for_each([&](std::size_t, const std::string &line) { wire_put_bytes(buf, line.data(), line.size()); });
+  wire_put_varint(buf, sv.size());
+  for (const auto &kv : sv) {
+    wire_put_bytes(buf, kv.first.data(), kv.first.size());
+    wire_put_varint(buf, kv.second);
+  }
+  if (doc_replace_file(log.snap_path.c_str(), buf.data(), buf.size(), true, nullptr) != 0) return -2;
+  return start_log(log, log.gen + 1);
+}
+
+void oplog_close(OpLog &log) {
+  oplog_sync(log);
+  if (log.fd >= 0) close(log.fd);
+  log.fd = -1;
+}
@@ -0,0 +1,118 @@
+#include "../include/peers.h"
+#include "../include/replica.h"
+
+#include <fcntl.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+static uint64_t monotonic_ns() {
+  struct timespec ts{};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+static void peer_disconnect(PeerConn &p) {
+  if (p.mq != (mqd_t)-1) {
+    mq_close(p.mq);
+    p.mq = (mqd_t)-1;
+  }
+  if (p.ring) {
+    shm_ring_detach(p.ring);
+    p.ring = nullptr;
+  }
+  p.live = false;
+}
+
+static bool peer_connect(PeerConn &p) {
+  peer_disconnect(p);
+  p.check_ns = monotonic_ns() + static_cast<uint64_t>(PEER_CHECK_MS) * 1000000ull;
+  if (p.queue_name[0] == '\0') return false;
+  if (is_shm_endpoint(p.queue_name)) {
+    p.live = shm_ring_attach(p.queue_name, p.ring) == 0;
+    if (!p.live) p.ring = nullptr;
+    return p.live;
+  }
+  p.mq = mq_open(p.queue_name, O_WRONLY | O_NONBLOCK);
+  p.live = (p.mq != (mqd_t)-1);
+  return p.live;
+}
+
+void peers_init(PeerTable &t, int self_slot) {
+  t.self_slot = self_slot;
+  t.local_seq = 0;
+  for (std::size_t i = 0; i < MAX_USERS; ++i) {
+    PeerConn &p = t.peers[i];
+    p.active = 0;
+    p.generation = 0;
+    p.user_id[0] = '\0';
+    p.queue_name[0] = '\0';
+    p.mq = (mqd_t)-1;
+    p.ring = nullptr;
+    p.live = false;
+    p.check_ns = 0;
+    p.replica = REPLICA_NONE;
+    p.base = p.sent_upto = p.acked = 0;
+    p.acked_ns = p.stall_ns = p.retry_ns = 0;
+    p.retry_ms = 0;
+  }
+}
+
+bool peers_refresh(PeerTable &t, const RegistrySegment *seg) {
+  bool changed = false;
+  uint64_t now = monotonic_ns();
+  for (std::size_t i = 0; i < MAX_USERS; ++i) {
+    if (static_cast<int>(i) == t.self_slot) continue;
+    const UserEntry &e = seg->users[i];
+    PeerConn &p = t.peers[i];
+    int active = e.active;
+    uint32_t gen = e.generation;
+    if (active == p.active && gen == p.generation &&
+        std::strncmp(e.queue_name, p.queue_name, QUEUE_NAME_MAX) == 0) {
+      // Unchanged slot: retry peers whose queue was not there yet, and
+      // re-open live ones now and then in case their queue was unlinked
+      if (active && !p.live && peer_connect(p)) changed = true;
+      else if (p.live && now >= p.check_ns && !peer_connect(p)) changed = true;
+      continue;
+    }
+    peer_disconnect(p);
+    p.active = active;
+    p.generation = gen;
+    std::snprintf(p.user_id, USER_ID_MAX, "%s", active ? e.user_id : "");
+    std::snprintf(p.queue_name, QUEUE_NAME_MAX, "%s", active ? e.queue_name : "");
+    p.replica = active ? replica_intern(p.user_id) : REPLICA_NONE;
+    p.base = p.sent_upto = p.acked = t.local_seq;
+    p.acked_ns = p.stall_ns = p.retry_ns = 0;
+    p.retry_ms = 0;
+    if (active) peer_connect(p);
+    changed = true;
+  }
+  return changed;
+}
+
+int peer_send(PeerConn &p, const char *data, std::size_t n) {
+  if (!p.active) return -1;
+  if (!p.live && !peer_connect(p)) return -1;
+  if (p.ring) return shm_ring_push(p.ring, data, n);
+  if (mq_send(p.mq, data, n, 0) == 0) return 0;
+  if (errno != EBADF) return -1; // e.g. EAGAIN: queue full, descriptor still good
+  // Stale descriptor: reopen once and retry (a queue that is gone leaves the
+  // peer dead)
+  if (!peer_connect(p)) return -1;
+  return mq_send(p.mq, data, n, 0) == 0 ? 0 : -1;
+}
+
+PeerConn *peers_find(PeerTable &t, const char *user_id) {
+  for (std::size_t i = 0; i < MAX_USERS; ++i) {
+    PeerConn &p = t.peers[i];
+    if (p.active && static_cast<int>(i) != t.self_slot && std::strncmp(p.user_id, user_id, USER_ID_MAX) == 0) {
+      return &p;
+    }
+  }
+  return nullptr;
+}
+
+void peers_close(PeerTable &t) {
+  for (std::size_t i = 0; i < MAX_USERS; ++i) peer_disconnect(t.peers[i]);
+}
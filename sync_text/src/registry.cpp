@@ -8,7 +8,7 @@
 #include <cstdio>
 
 static constexpr uint32_t REGISTRY_MAGIC = 0x53595854; // 'SYXT'
-static constexpr uint32_t REGISTRY_VERSION = 1;
+static constexpr uint32_t REGISTRY_VERSION = 2;
 static constexpr std::size_t REGISTRY_SIZE = sizeof(RegistrySegment);
 
 static void initialize_segment(RegistrySegment *seg) {
@@ -18,6 +18,7 @@ static void initialize_segment(RegistrySegment *seg) {
     seg->users[i].active = 0;
     seg->users[i].user_id[0] = '\0';
     seg->users[i].queue_name[0] = '\0';
+    seg->users[i].generation = 0;
   }
 }
 
@@ -38,20 +39,22 @@ int registry_open_or_create(int &fd, RegistrySegment *&seg) {
   }
   seg = reinterpret_cast<RegistrySegment *>(addr);
 
-  // If not initialized, set up
-  if (seg->magic != REGISTRY_MAGIC) {
+  // If not initialized (or laid out by an older build), set up
+  if (seg->magic != REGISTRY_MAGIC || seg->version != REGISTRY_VERSION) {
     initialize_segment(seg);
   }
   return 0;
 }
 
-int registry_register(RegistrySegment *seg, const char *user_id, const char *queue_name, int &assigned_index) {
+int registry_register(RegistrySegment *seg, const char *user_id, const char *queue_name, int &assigned_index,
+                      uint32_t &generation) {
   assigned_index = -1;
   // First, if user_id already exists, mark active and return same slot
   for (std::size_t i = 0; i < MAX_USERS; ++i) {
     if (seg->users[i].active == 1 && std::strncmp(seg->users[i].user_id, user_id, USER_ID_MAX) == 0) {
       // Update queue name in case
       std::snprintf(seg->users[i].queue_name, QUEUE_NAME_MAX, "%s", queue_name ? queue_name : "");
+      generation = __sync_add_and_fetch(&seg->users[i].generation, 1);
       assigned_index = static_cast<int>(i);
       return 0;
     }
@@ -63,6 +66,7 @@ int registry_register(RegistrySegment *seg, const char *user_id, const char *que
     if (__sync_bool_compare_and_swap(active_ptr, 0, 1)) {
       std::snprintf(seg->users[i].user_id, USER_ID_MAX, "%s", user_id);
       std::snprintf(seg->users[i].queue_name, QUEUE_NAME_MAX, "%s", queue_name ? queue_name : "");
+      generation = __sync_add_and_fetch(&seg->users[i].generation, 1);
       assigned_index = static_cast<int>(i);
       return 0;
     }
@@ -0,0 +1,22 @@
+#include "../include/replica.h"
+
+#include <deque>
+#include <string>
+#include <unordered_map>
+
+static std::deque<std::string> g_names;                             // by id; never moves
+static std::unordered_map<std::string_view, uint16_t> g_ids; // keys view into g_names
+
+uint16_t replica_intern(std::string_view name) {
+  auto it = g_ids.find(name);
+  if (it != g_ids.end()) return it->second;
+  if (g_names.size() >= REPLICA_MAX) return REPLICA_NONE;
+  uint16_t id = static_cast<uint16_t>(g_names.size());
+  g_names.emplace_back(name);
+  g_ids.emplace(g_names.back(), id);
+  return id;
+}
+
+std::string_view replica_name(uint16_t id) {
+  return id < g_names.size() ? std::string_view(g_names[id]) : std::string_view();
+}
@@ -0,0 +1,478 @@
+#include "../include/rga.h"
+#include "../include/replica.h"
+#include "../include/wire.h"
+
+#include <algorithm>
+#include <cstring>
+
+static uint32_t count_nl(std::string_view s) {
+  return static_cast<uint32_t>(std::count(s.begin(), s.end(), '\n'));
+}
+
+void SeqDoc::update(Node *n) {
+  n->height = std::max(height_of(n->left), height_of(n->right)) + 1;
+  n->vis = vis_of(n->left) + vis_of(n->right) + (n->deleted ? 0 : n->len);
+  n->nl = nl_of(n->left) + nl_of(n->right) + n->text_nl;
+}
+
+SeqDoc::Node *SeqDoc::next(Node *n) {
+  if (n->right) {
+    n = n->right;
+    while (n->left) n = n->left;
+    return n;
+  }
+  while (n->parent && n->parent->right == n) n = n->parent;
+  return n->parent;
+}
+
+SeqDoc::Node *SeqDoc::first() const {
+  Node *n = root;
+  while (n && n->left) n = n->left;
+  return n;
+}
+
+void SeqDoc::rotate(Node *x) {
+  Node *p = x->parent;
+  Node *g = p->parent;
+  if (p->left == x) {
+    p->left = x->right;
+    if (x->right) x->right->parent = p;
+    x->right = p;
+  } else {
+    p->right = x->left;
+    if (x->left) x->left->parent = p;
+    x->left = p;
+  }
+  p->parent = x;
+  x->parent = g;
+  if (!g) root = x;
+  else if (g->left == p) g->left = x;
+  else g->right = x;
+  update(p);
+  update(x);
+}
+
+// Refresh counts from n up to the root, restoring the AVL invariant on the way
+void SeqDoc::rebalance(Node *n) {
+  for (; n; n = n->parent) {
+    update(n);
+    int bf = height_of(n->left) - height_of(n->right);
+    if (bf > 1) {
+      Node *c = n->left;
+      if (height_of(c->right) > height_of(c->left)) {
+        rotate(c->right);
+        c = n->left;
+      }
+      rotate(c);
+      n = c;
+    } else if (bf < -1) {
+      Node *c = n->right;
+      if (height_of(c->left) > height_of(c->right)) {
+        rotate(c->left);
+        c = n->right;
+      }
+      rotate(c);
+      n = c;
+    }
+  }
+}
+
+void SeqDoc::link_after(Node *pos, Node *x) {
+  if (!root) {
+    root = x;
+    return;
+  }
+  Node *at;
+  if (pos && !pos->right) {
+    pos->right = x;
+    at = pos;
+  } else {
+    at = pos ? pos->right : root;
+    while (at->left) at = at->left;
+    at->left = x;
+  }
+  x->parent = at;
+  rebalance(at);
+}
+
+SeqDoc::Node *SeqDoc::make(uint64_t ts, uint16_t rid, std::string text, bool deleted, uint32_t len) {
+  nodes.emplace_back();
+  Node *n = &nodes.back();
+  n->ts = ts;
+  n->rid = rid;
+  n->len = len;
+  n->deleted = deleted;
+  n->text_nl = deleted ? 0 : count_nl(text);
+  n->text = std::move(text);
+  update(n);
+  index[{rid, ts}] = n;
+  return n;
+}
+
+SeqDoc::Node *SeqDoc::find(uint16_t rid, uint64_t ts, std::size_t &off) const {
+  auto it = index.upper_bound({rid, ts});
+  if (it == index.begin()) return nullptr;
+  --it;
+  Node *n = it->second;
+  if (it->first.first != rid || ts - n->ts >= n->len) return nullptr;
+  off = static_cast<std::size_t>(ts - n->ts);
+  return n;
+}
+
+// Cut n before character off; returns the new right part
+SeqDoc::Node *SeqDoc::split(Node *n, std::size_t off) {
+  std::string tail = n->deleted ? std::string() : n->text.substr(off);
+  Node *m = make(n->ts + off, n->rid, std::move(tail), n->deleted, n->len - static_cast<uint32_t>(off));
+  if (!n->deleted) n->text.resize(off);
+  n->len = static_cast<uint32_t>(off);
+  n->text_nl -= m->text_nl;
+  link_after(n, m); // rebalancing passes through n and refreshes its counts
+  return m;
+}
+
+SeqDoc::Node *SeqDoc::at_visible(std::size_t p, std::size_t &off) const {
+  Node *n = root;
+  while (n) {
+    if (p < vis_of(n->left)) {
+      n = n->left;
+      continue;
+    }
+    p -= vis_of(n->left);
+    std::size_t own = n->deleted ? 0 : n->len;
+    if (p < own) {
+      off = p;
+      return n;
+    }
+    p -= own;
+    n = n->right;
+  }
+  return nullptr;
+}
+
+// Visible characters and newlines before n
+void SeqDoc::prefix(const Node *n, std::size_t &vis, std::size_t &nl) const {
+  vis = vis_of(n->left);
+  nl = nl_of(n->left);
+  for (; n->parent; n = n->parent) {
+    const Node *p = n->parent;
+    if (p->right != n) continue;
+    vis += vis_of(p->left) + (p->deleted ? 0 : p->len);
+    nl += nl_of(p->left) + p->text_nl;
+  }
+}
+
+std::size_t SeqDoc::size() const { return vis_of(root); }
+std::size_t SeqDoc::newlines() const { return nl_of(root); }
+
+std::size_t SeqDoc::line_start(std::size_t l) const {
+  if (l == 0) return 0;
+  if (l > newlines()) return std::string::npos;
+  std::size_t base = 0;
+  const Node *n = root;
+  while (n) {
+    if (l <= nl_of(n->left)) {
+      n = n->left;
+      continue;
+    }
+    l -= nl_of(n->left);
+    base += vis_of(n->left);
+    if (l <= n->text_nl) {
+      const char *s = n->text.data();
+      const char *q = s;
+      for (;; ++q) {
+        q = static_cast<const char *>(std::memchr(q, '\n', n->text.size() - static_cast<std::size_t>(q - s)));
+        if (--l == 0) break;
+      }
+      return base + static_cast<std::size_t>(q - s) + 1;
+    }
+    l -= n->text_nl;
+    base += n->deleted ? 0 : n->len;
+    n = n->right;
+  }
+  return std::string::npos;
+}
+
+void SeqDoc::origin_at(std::size_t p, uint64_t &ref_ts, uint16_t &ref_rid) const {
+  std::size_t off;
+  const Node *n = p > 0 ? at_visible(p - 1, off) : nullptr;
+  ref_ts = n ? n->ts + off : 0;
+  ref_rid = n ? n->rid : REPLICA_NONE;
+}
+
+void SeqDoc::spans(std::size_t p, std::size_t n, std::vector<SeqSpan> &out) const {
+  out.clear();
+  std::size_t off;
+  Node *it = at_visible(p, off);
+  for (; it && n > 0; it = next(it), off = 0) {
+    if (it->deleted) continue;
+    std::size_t k = std::min<std::size_t>(it->len - off, n);
+    uint64_t ts = it->ts + off;
+    if (!out.empty() && out.back().rid == it->rid && out.back().ts + out.back().len == ts) out.back().len += k;
+    else out.push_back(SeqSpan{it->rid, ts, k});
+    n -= k;
+  }
+}
+
+// Id order of concurrent inserts: timestamp, then author name
+bool SeqDoc::greater(const Node *n, uint64_t ts, uint16_t rid) const {
+  if (n->ts != ts) return n->ts > ts;
+  return replica_name(n->rid) > replica_name(rid);
+}
+
+// Replace Document lines [l, l + old_count) with the sequence's lines
+// [l, l + new_count) after an op changed the text between them
+void SeqDoc::refresh_lines(std::size_t l, std::size_t old_count, std::size_t new_count) {
+  std::vector<std::string> fresh(1);
+  std::size_t off = 0;
+  std::size_t start = line_start(l);
+  Node *n = start < size() ? at_visible(start, off) : nullptr;
+  for (; n; n = next(n), off = 0) {
+    if (n->deleted) continue;
+    std::string_view t(n->text);
+    t.remove_prefix(off);
+    std::size_t k;
+    while ((k = t.find('\n')) != std::string_view::npos && fresh.size() < new_count) {
+      fresh.back().append(t.substr(0, k));
+      fresh.emplace_back();
+      t.remove_prefix(k + 1);
+    }
+    if (k != std::string_view::npos) {
+      fresh.back().append(t.substr(0, k));
+      break;
+    }
+    fresh.back().append(t);
+  }
+  fresh.resize(new_count);
+  std::size_t common = std::min(old_count, new_count);
+  for (std::size_t i = 0; i < common; ++i) doc.set(l + i, std::move(fresh[i]));
+  for (std::size_t i = common; i < new_count; ++i) doc.insert(l + i, std::move(fresh[i]));
+  for (std::size_t i = common; i < old_count; ++i) doc.erase(l + common);
+}
+
+int SeqDoc::try_apply(const SeqOp &op, Id &missing) {
+  if (op.text.empty()) return 0;
+  std::size_t off;
+  if (op.op == OpType::SeqInsert) {
+    if (find(op.rid, op.ts, off)) return 0; // duplicate
+    Node *pos = nullptr;
+    if (op.ref_ts != 0) {
+      pos = find(op.ref_rid, op.ref_ts, off);
+      if (!pos) {
+        missing = Id(op.ref_rid, op.ref_ts);
+        return -1;
+      }
+      if (off + 1 < pos->len) split(pos, off + 1);
+    }
+    Node *origin = pos;
+    Node *nx = pos ? next(pos) : first();
+    while (nx && greater(nx, op.ts, op.rid)) {
+      pos = nx;
+      nx = next(nx);
+    }
+    uint32_t nl = count_nl(op.text);
+    std::size_t vis_before, nl_before;
+    if (pos && pos == origin && !pos->deleted && pos->rid == op.rid && pos->ts + pos->len == op.ts) {
+      // Typing on from the end of our own run: extend it
+      prefix(pos, vis_before, nl_before);
+      nl_before += pos->text_nl;
+      pos->text.append(op.text);
+      pos->len += static_cast<uint32_t>(op.text.size());
+      pos->text_nl += nl;
+      for (Node *c = pos; c; c = c->parent) update(c);
+    } else {
+      Node *x = make(op.ts, op.rid, std::string(op.text), false, static_cast<uint32_t>(op.text.size()));
+      link_after(pos, x);
+      prefix(x, vis_before, nl_before);
+    }
+    max_ts_ = std::max(max_ts_, op.ts + op.text.size() - 1);
+    refresh_lines(nl_before, 1, 1 + nl);
+    return 1;
+  }
+
+  // Delete: all targets must be present before anything is tombstoned
+  std::size_t len = op.text.size();
+  for (std::size_t done = 0; done < len;) {
+    Node *n = find(op.ref_rid, op.ref_ts + done, off);
+    if (!n) {
+      missing = Id(op.ref_rid, op.ref_ts + done);
+      return -1;
+    }
+    done += n->len - off;
+  }
+  bool changed = false;
+  for (std::size_t done = 0; done < len;) {
+    Node *n = find(op.ref_rid, op.ref_ts + done, off);
+    if (n->deleted) {
+      done += n->len - off;
+      continue;
+    }
+    if (off > 0) n = split(n, off);
+    if (n->len > len - done) split(n, len - done);
+    done += n->len;
+    std::size_t vis_before, nl_before;
+    prefix(n, vis_before, nl_before);
+    uint32_t removed_nl = n->text_nl;
+    n->deleted = true;
+    n->text_nl = 0;
+    std::string().swap(n->text);
+    for (Node *c = n; c; c = c->parent) update(c);
+    refresh_lines(nl_before, 1 + removed_nl, 1);
+    changed = true;
+  }
+  max_ts_ = std::max(max_ts_, op.ts);
+  return changed ? 1 : 0;
+}
+
+bool SeqDoc::apply(const SeqOp &op) {
+  Id missing;
+  int r = try_apply(op, missing);
+  if (r < 0) {
+    pending.emplace(missing, Parked{op.op, op.ts, op.rid, op.ref_ts, op.ref_rid, std::string(op.text)});
+    return false;
+  }
+  bool changed = r > 0;
+  // An applied insert brings the ids ts .. ts+n-1: retry only the ops parked
+  // on one of them. Those may bring more, or park again on another id.
+  std::vector<Parked> ready;
+  auto release = [&](const SeqOp &o) {
+    if (o.op != OpType::SeqInsert || pending.empty()) return;
+    auto lo = pending.lower_bound(Id(o.rid, o.ts));
+    auto hi = pending.upper_bound(Id(o.rid, o.ts + o.text.size() - 1));
+    for (auto it = lo; it != hi; ++it) ready.push_back(std::move(it->second));
+    pending.erase(lo, hi);
+  };
+  if (r > 0) release(op);
+  while (!ready.empty()) {
+    Parked k = std::move(ready.back());
+    ready.pop_back();
+    SeqOp o{k.op, k.ts, k.rid, k.ref_ts, k.ref_rid, k.text};
+    r = try_apply(o, missing);
+    if (r < 0) {
+      pending.emplace(missing, std::move(k));
+      continue;
+    }
+    changed |= r > 0;
+    if (r > 0) release(o);
+  }
+  return changed;
+}
+
+void SeqDoc::reset(const Document &base) {
+  root = nullptr;
+  nodes.clear();
+  index.clear();
+  pending.clear();
+  max_ts_ = 0;
+  std::vector<std::string> lines;
+  lines.reserve(base.size() + 1);
+  // The base text's ids depend only on its content: author "", ts 1..n. It
+  // is stored one item per line so no split or scan has to walk the file.
+  uint16_t rid = replica_intern("");
+  uint64_t ts = 1;
+  Node *last = nullptr;
+  base.for_each([&](std::size_t, const std::string &line) {
+    uint32_t len = static_cast<uint32_t>(line.size() + 1);
+    Node *x = make(ts, rid, line + '\n', false, len);
+    link_after(last, x);
+    last = x;
+    ts += len;
+    lines.push_back(line);
+  });
+  lines.emplace_back();
+  doc = Document(std::move(lines));
+}
+
+static void put_op(std::string &out, OpType op, uint64_t ts, uint16_t rid, uint64_t ref_ts, uint16_t ref_rid,
+                   std::string_view text) {
+  out.push_back(static_cast<char>(op));
+  std::string_view author = replica_name(rid);
+  wire_put_bytes(out, author.data(), author.size());
+  wire_put_varint(out, ts);
+  std::string_view ref = ref_ts != 0 ? replica_name(ref_rid) : std::string_view();
+  wire_put_bytes(out, ref.data(), ref.size());
+  wire_put_varint(out, ref_ts);
+  wire_put_bytes(out, text.data(), text.size());
+}
+
+static bool get_name(const char *&p, const char *end, uint16_t &rid) {
+  const char *data;
+  std::size_t n;
+  if (!wire_get_bytes(p, end, data, n) || n >= USER_ID_MAX) return false;
+  rid = replica_intern(std::string_view(data, n));
+  return rid != REPLICA_NONE;
+}
+
+// Body: varint count, count x { varint author_len, author bytes, varint ts,
+//                               varint len, u8 deleted, text bytes unless deleted }
+//       varint op_count, op_count x { u8 op, varint author_len, author bytes, varint ts,
+//                                     varint ref_len, ref bytes, varint ref_ts,
+//                                     varint text_len, text bytes }
+void SeqDoc::encode(std::string &out, const std::vector<SeqOp> &extra) const {
+  wire_put_varint(out, nodes.size());
+  for (Node *n = first(); n; n = next(n)) {
+    std::string_view author = replica_name(n->rid);
+    wire_put_bytes(out, author.data(), author.size());
+    wire_put_varint(out, n->ts);
+    wire_put_varint(out, n->len);
+    out.push_back(n->deleted ? 1 : 0);
+    if (!n->deleted) out += n->text;
+  }
+  wire_put_varint(out, pending.size() + extra.size());
+  for (const auto &e : pending) {
+    const Parked &k = e.second;
+    put_op(out, k.op, k.ts, k.rid, k.ref_ts, k.ref_rid, k.text);
+  }
+  for (const auto &op : extra) put_op(out, op.op, op.ts, op.rid, op.ref_ts, op.ref_rid, op.text);
+}
+
+bool SeqDoc::decode(const char *&p, const char *end) {
+  reset(Document());
+  uint64_t count;
+  if (!wire_get_varint(p, end, count)) return false;
+  Node *last = nullptr;
+  std::string text;
+  for (uint64_t i = 0; i < count; ++i) {
+    uint16_t rid;
+    uint64_t ts, len;
+    if (!get_name(p, end, rid) || !wire_get_varint(p, end, ts) || !wire_get_varint(p, end, len) || len == 0 ||
+        len > UINT32_MAX || p >= end) {
+      return false;
+    }
+    bool deleted = *p++ != 0;
+    std::string chars;
+    if (!deleted) {
+      if (len > static_cast<uint64_t>(end - p)) return false;
+      chars.assign(p, static_cast<std::size_t>(len));
+      p += len;
+      text += chars;
+    }
+    std::size_t off;
+    if (find(rid, ts, off) || find(rid, ts + len - 1, off)) return false; // overlapping ids
+    Node *x = make(ts, rid, std::move(chars), deleted, static_cast<uint32_t>(len));
+    link_after(last, x);
+    last = x;
+    max_ts_ = std::max(max_ts_, ts + len - 1);
+  }
+  std::vector<std::string> lines(1);
+  for (char c : text) {
+    if (c == '\n') lines.emplace_back();
+    else lines.back().push_back(c);
+  }
+  doc = Document(std::move(lines));
+
+  if (!wire_get_varint(p, end, count)) return false;
+  for (uint64_t i = 0; i < count; ++i) {
+    SeqOp op;
+    const char *data;
+    std::size_t n;
+    if (p >= end) return false;
+    op.op = static_cast<OpType>(*p++);
+    if (!op_is_seq(op.op) || !get_name(p, end, op.rid) || !wire_get_varint(p, end, op.ts) ||
+        !get_name(p, end, op.ref_rid) || !wire_get_varint(p, end, op.ref_ts) || !wire_get_bytes(p, end, data, n)) {
+      return false;
+    }
+    op.text = std::string_view(data, n);
+    apply(op);
+  }
+  return true;
+}
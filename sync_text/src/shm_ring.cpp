@@ -0,0 +1,207 @@
+#include "../include/shm_ring.h"
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <new>
+
+static constexpr uint32_t SHM_RING_MAGIC = 0x53595252; // 'SYRR'
+static constexpr uint32_t SHM_RING_VERSION = 3;
+static constexpr uint64_t SHM_RING_MASK = SHM_RING_SLOTS - 1;
+
+static long futex(std::atomic<uint32_t> *addr, int op, uint32_t val, const struct timespec *ts) {
+  return syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), op, val, ts, nullptr, 0);
+}
+
+bool is_shm_endpoint(const char *name) {
+  return std::strncmp(name, SHM_RING_PREFIX, sizeof(SHM_RING_PREFIX) - 1) == 0;
+}
+
+static ShmRing *map_ring(int fd) {
+  void *addr = mmap(nullptr, sizeof(ShmRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  return addr == MAP_FAILED ? nullptr : reinterpret_cast<ShmRing *>(addr);
+}
+
+int shm_ring_create(const char *name, ShmRing *&ring) {
+  shm_unlink(name);
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0666);
+  if (fd < 0) return -1;
+  if (ftruncate(fd, sizeof(ShmRing)) != 0) {
+    close(fd);
+    shm_unlink(name);
+    return -2;
+  }
+  ring = map_ring(fd);
+  if (!ring) {
+    shm_unlink(name);
+    return -3;
+  }
+  // Fresh pages are zeroed; construct the atomics in place
+  new (&ring->enqueue_pos) std::atomic<uint64_t>(0);
+  new (&ring->dequeue_pos) std::atomic<uint64_t>(0);
+  ring->stall_pos = 0;
+  ring->stall_since_ns = 0;
+  new (&ring->futex_word) std::atomic<uint32_t>(0);
+  new (&ring->sleeping) std::atomic<uint32_t>(0);
+  for (std::size_t i = 0; i < SHM_RING_SLOTS; ++i) {
+    new (&ring->slots[i].seq) std::atomic<uint64_t>(i);
+    ring->slots[i].len = 0;
+  }
+  ring->version = SHM_RING_VERSION;
+  std::atomic_thread_fence(std::memory_order_release);
+  ring->magic = SHM_RING_MAGIC;
+  return 0;
+}
+
+int shm_ring_attach(const char *name, ShmRing *&ring) {
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0) return -1;
+  struct stat st{};
+  if (fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(ShmRing)) {
+    close(fd);
+    return -2;
+  }
+  ring = map_ring(fd);
+  if (!ring) return -3;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (ring->magic != SHM_RING_MAGIC || ring->version != SHM_RING_VERSION) {
+    shm_ring_detach(ring);
+    ring = nullptr;
+    return -4;
+  }
+  return 0;
+}
+
+void shm_ring_detach(ShmRing *ring) {
+  if (ring) munmap(ring, sizeof(ShmRing));
+}
+
+static uint64_t claim_word(uint64_t pos, uint32_t pid) {
+  return SHM_RING_CLAIMED | static_cast<uint64_t>(pid) << 32 | (pos & 0xFFFFFFFFu);
+}
+
+// Signed distance from pos to the position a claim word was taken at
+static int32_t claim_offset(uint64_t seq, uint64_t pos) {
+  return static_cast<int32_t>(static_cast<uint32_t>(seq) - static_cast<uint32_t>(pos));
+}
+
+// The slot at pos was claimed: move enqueue_pos past it unless its claimer
+// (or another helper) already has
+static void advance_past(ShmRing *ring, uint64_t pos) {
+  ring->enqueue_pos.compare_exchange_strong(pos, pos + 1, std::memory_order_relaxed);
+}
+
+int shm_ring_push(ShmRing *ring, const char *data, std::size_t n) {
+  if (n > WIRE_MSG_MAX) return -1;
+  static const uint32_t self = static_cast<uint32_t>(getpid());
+  uint64_t pos = ring->enqueue_pos.load(std::memory_order_relaxed);
+  ShmRingSlot *slot;
+  uint64_t claim;
+  for (;;) {
+    slot = &ring->slots[pos & SHM_RING_MASK];
+    uint64_t seq = slot->seq.load(std::memory_order_acquire);
+    if (seq == pos) {
+      claim = claim_word(pos, self);
+      if (slot->seq.compare_exchange_weak(seq, claim, std::memory_order_acquire, std::memory_order_relaxed)) {
+        advance_past(ring, pos);
+        break;
+      }
+    } else if (seq & SHM_RING_CLAIMED) {
+      int32_t off = claim_offset(seq, pos);
+      if (off < 0) return -1; // full: still claimed from an earlier lap
+      if (off == 0) advance_past(ring, pos);
+    } else if (static_cast<int64_t>(seq - pos) < 0) {
+      return -1; // full
+    }
+    pos = ring->enqueue_pos.load(std::memory_order_relaxed);
+  }
+  std::memcpy(slot->data, data, n);
+  slot->len = static_cast<uint32_t>(n);
+  // Fails only if the consumer gave the slot up as abandoned (see abandoned())
+  if (!slot->seq.compare_exchange_strong(claim, pos + 1, std::memory_order_release, std::memory_order_relaxed)) {
+    return -1;
+  }
+
+  ring->futex_word.fetch_add(1, std::memory_order_seq_cst);
+  if (ring->sleeping.load(std::memory_order_seq_cst)) {
+    futex(&ring->futex_word, FUTEX_WAKE, 1, nullptr);
+  }
+  return 0;
+}
+
+static uint64_t monotonic_ns() {
+  struct timespec ts{};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+// The slot at pos holds claim word seq: true once it has been unpublished
+// for SHM_RING_STALL_MS and its producer no longer exists. A live producer
+// is waited for however slow it is.
+static bool abandoned(ShmRing *ring, uint64_t seq, uint64_t pos) {
+  uint64_t now = monotonic_ns();
+  if (ring->stall_pos != pos + 1) {
+    ring->stall_pos = pos + 1;
+    ring->stall_since_ns = now;
+    return false;
+  }
+  if (now - ring->stall_since_ns < static_cast<uint64_t>(SHM_RING_STALL_MS) * 1000000ull) return false;
+  auto pid = static_cast<pid_t>((seq & ~SHM_RING_CLAIMED) >> 32);
+  return kill(pid, 0) != 0 && errno == ESRCH;
+}
+
+long shm_ring_pop(ShmRing *ring, char *buf, std::size_t cap) {
+  for (;;) {
+    uint64_t pos = ring->dequeue_pos.load(std::memory_order_relaxed);
+    ShmRingSlot *slot = &ring->slots[pos & SHM_RING_MASK];
+    uint64_t seq = slot->seq.load(std::memory_order_acquire);
+    if (seq == pos + 1) {
+      std::size_t n = slot->len;
+      if (n > cap) n = cap;
+      std::memcpy(buf, slot->data, n);
+      slot->seq.store(pos + SHM_RING_SLOTS, std::memory_order_release);
+      ring->dequeue_pos.store(pos + 1, std::memory_order_relaxed);
+      return static_cast<long>(n);
+    }
+    // Empty, or a producer is still writing
+    if (!(seq & SHM_RING_CLAIMED) || claim_offset(seq, pos) != 0 || !abandoned(ring, seq, pos)) return -1;
+    // Hand the slot to the next lap; a producer publishing right now wins.
+    // The dead producer may not have moved enqueue_pos past the slot yet.
+    advance_past(ring, pos);
+    if (slot->seq.compare_exchange_strong(seq, pos + SHM_RING_SLOTS, std::memory_order_release,
+                                          std::memory_order_acquire)) {
+      ring->dequeue_pos.store(pos + 1, std::memory_order_relaxed);
+    }
+    ring->stall_pos = 0;
+  }
+}
+
+bool shm_ring_stalled(const ShmRing *ring) {
+  uint64_t pos = ring->dequeue_pos.load(std::memory_order_relaxed);
+  uint64_t seq = ring->slots[pos & SHM_RING_MASK].seq.load(std::memory_order_acquire);
+  return (seq & SHM_RING_CLAIMED) && claim_offset(seq, pos) == 0;
+}
+
+void shm_ring_wait(ShmRing *ring, uint32_t seen, int timeout_ms) {
+  ring->sleeping.store(1, std::memory_order_seq_cst);
+  if (ring->futex_word.load(std::memory_order_seq_cst) == seen) {
+    struct timespec ts{};
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = static_cast<long>(timeout_ms % 1000) * 1000000L;
+    futex(&ring->futex_word, FUTEX_WAIT, seen, timeout_ms < 0 ? nullptr : &ts);
+  }
+  ring->sleeping.store(0, std::memory_order_relaxed);
+}
+
+void shm_ring_wake(ShmRing *ring) {
+  ring->futex_word.fetch_add(1, std::memory_order_seq_cst);
+  futex(&ring->futex_word, FUTEX_WAKE, 1, nullptr);
+}
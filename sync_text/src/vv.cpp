@@ -0,0 +1,68 @@
+#include "../include/vv.h"
+#include "../include/wire.h"
+
+#include <cstring>
+
+VvAdmit vv_admit(VersionVector &vv, std::string_view uid, uint64_t epoch, uint64_t seq) {
+  auto it = vv.find(uid);
+  if (it == vv.end()) {
+    vv.emplace(std::string(uid), SeqTrack{epoch, seq + 1});
+    return VvAdmit::Accept;
+  }
+  if (epoch > it->second.epoch) {
+    it->second = SeqTrack{epoch, seq + 1};
+    return VvAdmit::Accept;
+  }
+  SeqTrack &t = it->second;
+  if (epoch < t.epoch) return VvAdmit::Stale;
+  if (seq < t.next) return VvAdmit::Duplicate;
+  if (seq > t.next) return VvAdmit::Gap;
+  t.next++;
+  return VvAdmit::Accept;
+}
+
+void vv_frame(const char *sender, uint64_t epoch, uint64_t head, uint64_t floor, bool nack,
+              const VersionVector &vv, std::string &frame) {
+  frame.clear();
+  frame.push_back(static_cast<char>(WIRE_MAGIC));
+  frame.push_back(static_cast<char>(FrameKind::VersionVector));
+  wire_put_bytes(frame, sender, strnlen(sender, USER_ID_MAX - 1));
+  wire_put_varint(frame, epoch);
+  wire_put_varint(frame, head);
+  wire_put_varint(frame, floor);
+  frame.push_back(nack ? 1 : 0);
+  wire_put_varint(frame, vv.size());
+  for (const auto &kv : vv) {
+    wire_put_bytes(frame, kv.first.data(), kv.first.size());
+    wire_put_varint(frame, kv.second.epoch);
+    wire_put_varint(frame, kv.second.next - 1);
+  }
+}
+
+bool vv_parse(const char *data, std::size_t n, VvSummary &out) {
+  if (n < 2 || static_cast<FrameKind>(data[1]) != FrameKind::VersionVector) return false;
+  const char *p = data + 2;
+  const char *end = data + n;
+  const char *s;
+  std::size_t len;
+  if (!wire_get_bytes(p, end, s, len) || len >= USER_ID_MAX) return false;
+  std::memcpy(out.sender, s, len);
+  out.sender[len] = '\0';
+  uint64_t count;
+  if (!wire_get_varint(p, end, out.epoch) || !wire_get_varint(p, end, out.head) ||
+      !wire_get_varint(p, end, out.floor) || p >= end) {
+    return false;
+  }
+  out.nack = *p++ != 0;
+  if (!wire_get_varint(p, end, count)) return false;
+  out.entries.clear();
+  for (uint64_t i = 0; i < count; ++i) {
+    uint64_t epoch, received;
+    if (!wire_get_bytes(p, end, s, len) || !wire_get_varint(p, end, epoch) ||
+        !wire_get_varint(p, end, received)) {
+      return false;
+    }
+    out.entries[std::string(s, len)] = SeqTrack{epoch, received + 1};
+  }
+  return p == end;
+}
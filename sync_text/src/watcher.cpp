@@ -0,0 +1,116 @@
+#include "../include/watcher.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+// Saves may rewrite the file in place (close-write), replace it via rename
+// (moved-to), or only bump its timestamps (attrib, e.g. touch)
+static constexpr uint32_t DOC_EVENTS = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ATTRIB;
+
+static int add_fd(int epfd, int fd) {
+  struct epoll_event ev{};
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static bool setup_inotify(DocWatcher &w, const char *path) {
+  if (std::getenv("SYNCTEXT_POLL") != nullptr) return false;
+
+  std::string full(path);
+  std::string dir = ".";
+  std::string base = full;
+  size_t slash = full.rfind('/');
+  if (slash != std::string::npos) {
+    dir = slash == 0 ? "/" : full.substr(0, slash);
+    base = full.substr(slash + 1);
+  }
+  if (base.empty() || base.size() >= sizeof(w.name)) return false;
+  std::snprintf(w.name, sizeof(w.name), "%s", base.c_str());
+
+  w.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (w.inotify_fd < 0) return false;
+  w.wd = inotify_add_watch(w.inotify_fd, dir.c_str(), DOC_EVENTS);
+  if (w.wd < 0 || add_fd(w.epfd, w.inotify_fd) != 0) {
+    close(w.inotify_fd);
+    w.inotify_fd = -1;
+    w.wd = -1;
+    return false;
+  }
+  return true;
+}
+
+int watcher_open(DocWatcher &w, const char *path) {
+  w.epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (w.epfd < 0) return -1;
+
+  w.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (w.wake_fd < 0 || add_fd(w.epfd, w.wake_fd) != 0) {
+    watcher_close(w);
+    return -2;
+  }
+
+  w.polling = !setup_inotify(w, path);
+  return 0;
+}
+
+// Drain queued inotify events; report whether any refer to the document
+static bool drain_inotify(DocWatcher &w) {
+  alignas(struct inotify_event) char buf[4096];
+  bool hit = false;
+  for (;;) {
+    ssize_t r = read(w.inotify_fd, buf, sizeof(buf));
+    if (r <= 0) break;
+    for (char *p = buf; p < buf + r;) {
+      auto *ev = reinterpret_cast<struct inotify_event *>(p);
+      if (ev->mask & IN_Q_OVERFLOW) hit = true;
+      else if (ev->len > 0 && std::strcmp(ev->name, w.name) == 0) hit = true;
+      p += sizeof(struct inotify_event) + ev->len;
+    }
+  }
+  return hit;
+}
+
+// Block until the document changes, watcher_notify() is called, or timeout_ms
+// elapses. In polling mode every return also reports WATCH_FILE so the caller
+// re-checks the file as the original loop did.
+uint32_t watcher_wait(DocWatcher &w, int timeout_ms) {
+  struct epoll_event evs[4];
+  int n = epoll_wait(w.epfd, evs, 4, timeout_ms);
+  if (n < 0 && errno != EINTR) {
+    return WATCH_FILE | WATCH_TIMEOUT;
+  }
+  uint32_t mask = 0;
+  for (int i = 0; i < n; ++i) {
+    if (evs[i].data.fd == w.wake_fd) {
+      uint64_t v;
+      while (read(w.wake_fd, &v, sizeof(v)) == sizeof(v)) {}
+      mask |= WATCH_WAKE;
+    } else if (evs[i].data.fd == w.inotify_fd) {
+      if (drain_inotify(w)) mask |= WATCH_FILE;
+    }
+  }
+  if (n == 0) mask |= WATCH_TIMEOUT;
+  if (w.polling) mask |= WATCH_FILE;
+  return mask;
+}
+
+void watcher_notify(DocWatcher &w) {
+  uint64_t one = 1;
+  ssize_t r = write(w.wake_fd, &one, sizeof(one));
+  (void)r; // EAGAIN means the counter is already non-zero: a wake is pending
+}
+
+void watcher_close(DocWatcher &w) {
+  if (w.inotify_fd >= 0) close(w.inotify_fd);
+  if (w.wake_fd >= 0) close(w.wake_fd);
+  if (w.epfd >= 0) close(w.epfd);
+  w.inotify_fd = w.wake_fd = w.epfd = w.wd = -1;
+}
@@ -0,0 +1,247 @@
+#include "../include/wire.h"
+
+#include <algorithm>
+#include <cstdio>
+
+void wire_put_varint(std::string &out, uint64_t v) {
+  while (v >= 0x80) {
+    out.push_back(static_cast<char>((v & 0x7F) | 0x80));
+    v >>= 7;
+  }
+  out.push_back(static_cast<char>(v));
+}
+
+bool wire_get_varint(const char *&p, const char *end, uint64_t &v) {
+  v = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (p >= end) return false;
+    uint8_t b = static_cast<uint8_t>(*p++);
+    v |= static_cast<uint64_t>(b & 0x7F) << shift;
+    if (!(b & 0x80)) return true;
+  }
+  return false;
+}
+
+void wire_put_bytes(std::string &out, const char *data, std::size_t n) {
+  wire_put_varint(out, n);
+  out.append(data, n);
+}
+
+bool wire_get_bytes(const char *&p, const char *end, const char *&data, std::size_t &n) {
+  uint64_t len;
+  if (!wire_get_varint(p, end, len)) return false;
+  if (len > static_cast<uint64_t>(end - p)) return false;
+  data = p;
+  n = static_cast<std::size_t>(len);
+  p += n;
+  return true;
+}
+
+static uint64_t zigzag(int32_t v) {
+  return (static_cast<uint64_t>(static_cast<uint32_t>(v)) << 1) ^ static_cast<uint64_t>(static_cast<int64_t>(v) >> 63);
+}
+
+static int32_t unzigzag(uint64_t v) {
+  return static_cast<int32_t>((v >> 1) ^ (~(v & 1) + 1));
+}
+
+static void put_sender(std::string &out, uint16_t sender, uint32_t gen) {
+  wire_put_varint(out, static_cast<uint64_t>(gen) * MAX_USERS + sender);
+}
+
+static bool get_sender(const char *&p, const char *end, uint16_t &sender, uint32_t &gen) {
+  uint64_t tag;
+  if (!wire_get_varint(p, end, tag) || tag / MAX_USERS > UINT32_MAX) return false;
+  sender = static_cast<uint16_t>(tag % MAX_USERS);
+  gen = static_cast<uint32_t>(tag / MAX_USERS);
+  return true;
+}
+
+void wire_encode_op(const UpdateMessage &m, std::string &out) {
+  put_sender(out, m.sender, m.sender_gen);
+  wire_put_varint(out, m.hlc);
+  wire_put_varint(out, m.epoch);
+  wire_put_varint(out, m.seq);
+  wire_put_varint(out, m.line);
+  wire_put_varint(out, zigzag(m.col_start));
+  wire_put_varint(out, zigzag(m.col_end));
+  out.push_back(static_cast<char>(m.op));
+  wire_put_bytes(out, m.old_text.data(), m.old_text.size());
+  wire_put_bytes(out, m.new_text.data(), m.new_text.size());
+  if (op_is_seq(m.op)) {
+    wire_put_bytes(out, m.ref_author.data(), m.ref_author.size());
+    wire_put_varint(out, m.ref_ts);
+  }
+}
+
+bool wire_decode_view(const char *p, std::size_t n, UpdateView &v) {
+  const char *end = p + n;
+  const char *data;
+  std::size_t len;
+  uint64_t line, cs, ce;
+  if (!get_sender(p, end, v.sender, v.sender_gen)) return false;
+  if (!wire_get_varint(p, end, v.hlc) || !wire_get_varint(p, end, v.epoch) || !wire_get_varint(p, end, v.seq) ||
+      !wire_get_varint(p, end, line) || !wire_get_varint(p, end, cs) || !wire_get_varint(p, end, ce)) {
+    return false;
+  }
+  if (p >= end) return false;
+  uint8_t op = static_cast<uint8_t>(*p++);
+  if (op < static_cast<uint8_t>(OpType::Insert) || op > static_cast<uint8_t>(OpType::SeqDelete)) return false;
+  if (!wire_get_bytes(p, end, data, len)) return false;
+  v.old_text = std::string_view(data, len);
+  if (!wire_get_bytes(p, end, data, len)) return false;
+  v.new_text = std::string_view(data, len);
+  v.ref_ts = 0;
+  v.ref_author = {};
+  if (op_is_seq(static_cast<OpType>(op))) {
+    if (!wire_get_bytes(p, end, data, len) || len >= USER_ID_MAX || !wire_get_varint(p, end, v.ref_ts)) return false;
+    v.ref_author = std::string_view(data, len);
+  }
+  v.line = static_cast<uint32_t>(line);
+  v.col_start = unzigzag(cs);
+  v.col_end = unzigzag(ce);
+  v.op = static_cast<OpType>(op);
+  return true;
+}
+
+bool wire_decode_op(const char *p, std::size_t n, UpdateMessage &m) {
+  UpdateView v;
+  if (!wire_decode_view(p, n, v)) return false;
+  m.sender = v.sender;
+  m.sender_gen = v.sender_gen;
+  m.hlc = v.hlc;
+  m.epoch = v.epoch;
+  m.seq = v.seq;
+  m.line = v.line;
+  m.col_start = v.col_start;
+  m.col_end = v.col_end;
+  m.op = v.op;
+  m.old_text.assign(v.old_text);
+  m.new_text.assign(v.new_text);
+  m.ref_ts = v.ref_ts;
+  m.ref_author.assign(v.ref_author);
+  return true;
+}
+
+bool wire_frame_update(const UpdateMessage &m, uint64_t msg_id, std::vector<std::string> &frames) {
+  std::string body;
+  wire_encode_op(m, body);
+  if (body.size() > WIRE_OP_MAX) return false; // receivers would drop it
+  if (body.size() + 2 <= WIRE_MSG_MAX) {
+    std::string f;
+    f.reserve(body.size() + 2);
+    f.push_back(static_cast<char>(WIRE_MAGIC));
+    f.push_back(static_cast<char>(FrameKind::Op));
+    f += body;
+    frames.push_back(std::move(f));
+    return true;
+  }
+
+  const std::size_t chunk = WIRE_FRAGMENT_CHUNK;
+  uint64_t count = (body.size() + chunk - 1) / chunk;
+  for (uint64_t i = 0; i < count; ++i) {
+    std::string f;
+    f.push_back(static_cast<char>(WIRE_MAGIC));
+    f.push_back(static_cast<char>(FrameKind::Fragment));
+    put_sender(f, m.sender, m.sender_gen);
+    wire_put_varint(f, msg_id);
+    wire_put_varint(f, i);
+    wire_put_varint(f, count);
+    std::size_t off = static_cast<std::size_t>(i) * chunk;
+    f.append(body, off, std::min(chunk, body.size() - off));
+    frames.push_back(std::move(f));
+  }
+  return true;
+}
+
+bool wire_frame_batch(const std::vector<UpdateMessage> &ops, uint64_t &next_msg_id,
+                      std::vector<std::string> &frames) {
+  bool ok = true;
+  std::string frame;
+  std::string body;
+  std::string len;
+  auto flush = [&]() {
+    if (frame.size() > 2) frames.push_back(std::move(frame));
+    frame.clear();
+  };
+  for (const auto &m : ops) {
+    body.clear();
+    wire_encode_op(m, body);
+    len.clear();
+    wire_put_varint(len, body.size());
+    if (2 + len.size() + body.size() > WIRE_MSG_MAX) {
+      flush(); // earlier ops go out first: receivers admit each author's ops in order
+      ok &= wire_frame_update(m, next_msg_id++, frames);
+      continue;
+    }
+    if (frame.size() + len.size() + body.size() > WIRE_MSG_MAX) flush();
+    if (frame.empty()) {
+      frame.push_back(static_cast<char>(WIRE_MAGIC));
+      frame.push_back(static_cast<char>(FrameKind::Batch));
+    }
+    frame += len;
+    frame += body;
+  }
+  flush();
+  return ok;
+}
+
+bool WireReassembler::feed(const char *data, std::size_t n, std::vector<UpdateView> &out) {
+  if (n < 2 || static_cast<uint8_t>(data[0]) != WIRE_MAGIC) return false;
+  const char *p = data + 2;
+  const char *end = data + n;
+  auto kind = static_cast<FrameKind>(data[1]);
+
+  if (kind == FrameKind::Op) {
+    UpdateView v;
+    if (!wire_decode_view(p, static_cast<std::size_t>(end - p), v)) return false;
+    out.push_back(v);
+    return true;
+  }
+  if (kind == FrameKind::Batch) {
+    while (p < end) {
+      const char *body;
+      std::size_t body_n;
+      if (!wire_get_bytes(p, end, body, body_n)) return false;
+      UpdateView v;
+      if (!wire_decode_view(body, body_n, v)) return false;
+      out.push_back(v);
+    }
+    return true;
+  }
+  if (kind != FrameKind::Fragment) return false;
+
+  uint16_t sender;
+  uint32_t gen;
+  uint64_t msg_id, index, count;
+  if (!get_sender(p, end, sender, gen) || !wire_get_varint(p, end, msg_id) ||
+      !wire_get_varint(p, end, index) || !wire_get_varint(p, end, count) ||
+      count == 0 || index >= count ||
+      count > (WIRE_OP_MAX + WIRE_FRAGMENT_CHUNK - 1) / WIRE_FRAGMENT_CHUNK) {
+    return false;
+  }
+
+  auto it = std::find_if(pending.begin(), pending.end(), [&](const Pending &pe) {
+    return pe.msg_id == msg_id && pe.sender == sender && pe.sender_gen == gen;
+  });
+  if (it == pending.end()) {
+    if (pending.size() >= WIRE_MAX_PENDING) pending.erase(pending.begin());
+    pending.push_back(Pending{sender, gen, msg_id, count, 0, std::vector<std::string>(count)});
+    it = pending.end() - 1;
+  }
+  if (it->count != count) return false;
+  std::string &part = it->parts[index];
+  if (part.empty()) {
+    part.assign(p, end);
+    it->received++;
+  }
+  if (it->received < it->count) return true;
+
+  assembled.clear();
+  for (auto &s : it->parts) assembled += s;
+  pending.erase(it);
+  UpdateView v;
+  if (!wire_decode_view(assembled.data(), assembled.size(), v)) return false;
+  out.push_back(v);
+  return true;
+}
@@ -0,0 +1,133 @@
+// Merge tests for do_merge_apply (crdt.h): concurrent batches from two
+// authors against one baseline, where line inserts/deletes of one author
+// shift the lines the other author's ops refer to.
+//
+// Build and run: make test
+
+#include "../include/crdt.h"
+#include "../include/replica.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+static int g_failed = 0;
+
+static UpdateExt op(uint64_t ts, const char *author, OpType type, uint32_t line, int cs, std::string_view old_text,
+                    std::string_view new_text) {
+  UpdateExt u;
+  u.ts = ts;
+  u.rid = replica_intern(author);
+  u.line = line;
+  u.cs = cs;
+  u.ce = old_text.empty() ? cs : cs + static_cast<int>(old_text.size()) - 1;
+  u.op = type;
+  u.old_text = old_text;
+  u.new_text = new_text;
+  return u;
+}
+
+static UpdateExt line_insert(uint64_t ts, const char *author, uint32_t line, std::string_view text) {
+  return op(ts, author, OpType::LineInsert, line, 0, "", text);
+}
+
+static UpdateExt line_delete(uint64_t ts, const char *author, uint32_t line, std::string_view text) {
+  return op(ts, author, OpType::LineDelete, line, 0, text, "");
+}
+
+static std::string join(const Document &doc) {
+  std::string out;
+  doc.for_each([&](std::size_t i, const std::string &line) {
+    if (i > 0) out += ',';
+    out += line;
+  });
+  return out;
+}
+
+// Merge local (ours) and remote ops into base, in both roles: every replica
+// must produce expected whichever side the ops came from
+static void check(const char *name, const std::vector<std::string> &base, const std::vector<UpdateExt> &a,
+                  const std::vector<UpdateExt> &b, const std::string &expected) {
+  for (int swap = 0; swap < 2; ++swap) {
+    Document doc(base);
+    std::vector<UpdateExt> local = swap ? b : a;
+    std::vector<UpdateExt> recv = swap ? a : b;
+    do_merge_apply(doc, local, recv, "test");
+    std::string got = join(doc);
+    if (got != expected) {
+      std::printf("FAIL %s%s: got \"%s\", expected \"%s\"\n", name, swap ? " (swapped)" : "", got.c_str(),
+                  expected.c_str());
+      g_failed++;
+      return;
+    }
+  }
+  std::printf("ok   %s\n", name);
+}
+
+int main() {
+  const std::vector<std::string> abc = {"a", "b", "c"};
+
+  // A's line insert shifts the line B edited (B's op is newer)
+  check("insert above a concurrent edit", abc, {line_insert(10, "A", 0, "new")},
+        {op(11, "B", OpType::Replace, 2, 0, "c", "C")}, "new,a,b,C");
+  // Same with the edit older than the insert
+  check("edit older than the insert", abc, {line_insert(11, "A", 0, "new")},
+        {op(10, "B", OpType::Replace, 2, 0, "c", "C")}, "new,a,b,C");
+  // A's delete shifts B's edit up
+  check("delete above a concurrent edit", abc, {line_delete(10, "A", 0, "a")},
+        {op(11, "B", OpType::Replace, 2, 0, "c", "C")}, "b,C");
+  // An edit of a line deleted concurrently is dropped
+  check("edit of a deleted line", abc, {line_delete(10, "A", 1, "b")},
+        {op(11, "B", OpType::Replace, 1, 0, "b", "B")}, "a,c");
+  // Both delete the same line: it goes once, the next line stays
+  check("same line deleted twice", abc, {line_delete(10, "A", 1, "b")}, {line_delete(11, "B", 1, "b")}, "a,c");
+  // Both insert the same line at the same place: it is added once
+  check("same line inserted twice", abc, {line_insert(10, "A", 1, "x")}, {line_insert(11, "B", 1, "x")},
+        "a,x,b,c");
+  // A's own later edit refers to A's view (after its insert); B's delete
+  // refers to the baseline
+  check("own ops in own view", abc,
+        {line_insert(10, "A", 0, "new"), op(12, "A", OpType::Replace, 1, 0, "a", "A")},
+        {line_delete(11, "B", 2, "c")}, "new,A,b");
+  // Conflicting edits of one line written in different views: LWW still
+  // compares them (B's newer replace wins)
+  check("conflict across views", abc, {line_insert(10, "A", 0, "new"), op(11, "A", OpType::Replace, 3, 0, "c", "x")},
+        {op(12, "B", OpType::Replace, 2, 0, "c", "y")}, "new,a,b,y");
+  // Edits inside lines inserted concurrently by both
+  check("edits of inserted lines", abc,
+        {line_insert(10, "A", 3, "d"), op(12, "A", OpType::Insert, 3, 1, "", "!")},
+        {line_insert(11, "B", 0, "z")}, "z,a,b,c,d!");
+  // No line ops: unchanged column merge
+  check("column edits only", abc, {op(10, "A", OpType::Replace, 0, 0, "a", "A")},
+        {op(11, "B", OpType::Replace, 2, 0, "c", "C")}, "A,b,C");
+  // An insert replaces nothing: the character at its column stays
+  check("insert keeps the next character", {"int x = 10;"}, {op(10, "A", OpType::Insert, 0, 10, "", "5")}, {},
+        "int x = 105;");
+  // Several edits of both authors on one line, spliced in column order
+  check("sorted edits on one line", {"abcdefghij"},
+        {op(10, "A", OpType::Replace, 0, 1, "b", "B"), op(11, "A", OpType::Insert, 0, 4, "", "-")},
+        {op(12, "B", OpType::Delete, 0, 6, "g", ""), op(13, "B", OpType::Replace, 0, 8, "ij", "IJ"),
+         op(14, "B", OpType::Insert, 0, 10, "", "!")},
+        "aBcd-efhIJ!");
+
+  // Last: fills the process's replica table. Ids stop short of REPLICA_NONE
+  // and known names keep resolving.
+  uint16_t a = replica_intern("A");
+  uint16_t last = 0;
+  for (std::size_t i = 0; i < REPLICA_MAX; ++i) {
+    uint16_t id = replica_intern("user" + std::to_string(i));
+    if (id != REPLICA_NONE) last = id;
+  }
+  if (last == REPLICA_MAX - 1 && replica_intern("one more") == REPLICA_NONE && replica_intern("A") == a) {
+    std::printf("ok   replica table cap\n");
+  } else {
+    std::printf("FAIL replica table cap: last id %u\n", static_cast<unsigned>(last));
+    g_failed++;
+  }
+
+  if (g_failed > 0) {
+    std::printf("%d failed\n", g_failed);
+    return 1;
+  }
+  return 0;
+}
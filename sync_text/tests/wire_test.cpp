@@ -0,0 +1,78 @@
+// Wire format tests (wire.h): the WIRE_OP_MAX boundary between what a sender
+// frames and what a receiver reassembles.
+//
+// Build and run: make test
+
+#include "../include/wire.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+static int g_failed = 0;
+
+static void expect(const char *name, bool ok) {
+  std::printf("%s %s\n", ok ? "ok  " : "FAIL", name);
+  if (!ok) g_failed++;
+}
+
+static std::size_t body_size(const UpdateMessage &m) {
+  std::string body;
+  wire_encode_op(m, body);
+  return body.size();
+}
+
+// Frame m and feed the frames to a fresh receiver; true if it yields m back
+static bool round_trip(const UpdateMessage &m) {
+  std::vector<std::string> frames;
+  if (!wire_frame_update(m, 1, frames)) return false;
+  WireReassembler r;
+  std::vector<UpdateView> out;
+  for (const auto &f : frames) {
+    if (f.size() > WIRE_MSG_MAX || !r.feed(f.data(), f.size(), out)) return false;
+  }
+  return out.size() == 1 && out[0].seq == m.seq && out[0].new_text == m.new_text;
+}
+
+int main() {
+  UpdateMessage m{};
+  m.sender = 1;
+  m.hlc = 1;
+  m.epoch = 1;
+  m.seq = 1;
+  m.op = OpType::Insert;
+
+  // Grow new_text until the body is exactly WIRE_OP_MAX (its length varint
+  // has a fixed width this close to the limit)
+  m.new_text.assign(WIRE_OP_MAX - body_size(m), 'x');
+  m.new_text.resize(m.new_text.size() - (body_size(m) - WIRE_OP_MAX));
+  expect("body of WIRE_OP_MAX bytes is framed", body_size(m) == WIRE_OP_MAX && round_trip(m));
+
+  m.new_text.push_back('x');
+  std::vector<std::string> frames;
+  bool framed = wire_frame_update(m, 2, frames);
+  expect("body one byte over is refused", !framed && frames.empty());
+  uint64_t next_id = 3;
+  frames.clear();
+  UpdateMessage small = m;
+  small.new_text = "y";
+  framed = wire_frame_batch({small, m}, next_id, frames);
+  expect("batch leaves the oversized op out", !framed && frames.size() == 1);
+
+  // wire_op_fits must hold for the largest fields an op can carry
+  UpdateMessage big{};
+  big.sender = MAX_USERS - 1;
+  big.sender_gen = UINT32_MAX;
+  big.hlc = big.epoch = big.seq = big.ref_ts = UINT64_MAX;
+  big.line = UINT32_MAX;
+  big.col_start = INT32_MIN;
+  big.col_end = INT32_MIN;
+  big.op = OpType::SeqInsert;
+  big.ref_author.assign(USER_ID_MAX - 1, 'a');
+  std::size_t limit = WIRE_OP_MAX - WIRE_OP_OVERHEAD;
+  big.old_text.assign(limit / 2, 'o');
+  big.new_text.assign(limit - limit / 2, 'n');
+  expect("wire_op_fits bounds the largest op", wire_op_fits(limit) && !wire_op_fits(limit + 1) && round_trip(big));
+
+  return g_failed ? 1 : 0;
+}